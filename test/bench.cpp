@@ -0,0 +1,557 @@
+#include <math.h>
+
+#include <ethash/keccak.hpp>
+#include <lib/ethash/ethash-internal.hpp>
+
+#include "xleth.hpp"
+#include "cpudev.hpp"
+#include "hashimoto.hpp"
+#include "hostdag.hpp"
+#include "keccakx.hpp"
+
+//------------------------------------------------------------------------------
+// xleth_bench: throughput of the DAG, search, Keccak and transfer paths
+//------------------------------------------------------------------------------
+// Every case runs `reps` times and reports min/median/mean/stddev/max of the
+// rate. The JSON output is meant to be diffed between commits.
+
+void usage(char **argv)
+{
+    std::cout << "Usage: " << std::endl;
+    std::cout << argv[0] << " [--cpu <threads>] [--cl <Xilinx|AMD> <kernel-file>] [options]" << std::endl;
+    std::cout << "  --cpu <threads>   : CPU backend, 0 uses all cores (default)" << std::endl;
+    std::cout << "  --cl <platform> <kernel-file> : OpenCL backend, Xilinx takes an xclbin" << std::endl;
+    std::cout << "  --epoch E         : epoch of the DAG (default 0)" << std::endl;
+    std::cout << "  --reps R          : repetitions of every case (default 5)" << std::endl;
+    std::cout << "  --dag-items N     : DAG items generated per DAG case (default 1048576)" << std::endl;
+    std::cout << "  --only LIST       : comma separated of keccak,hashimoto,dag,search,transfer" << std::endl;
+    std::cout << "  --json FILE       : write the results as JSON" << std::endl;
+}
+
+struct BenchCase
+{
+    std::string group;  // keccak, hashimoto, dag, search, transfer
+    std::string name;
+    std::string params; // JSON object members
+    std::string unit;
+    std::vector<double> samples;
+};
+
+struct BenchStats
+{
+    double min, median, mean, stddev, max;
+};
+
+static std::vector<BenchCase> g_cases;
+
+static BenchStats bench_stats(std::vector<double> v)
+{
+    BenchStats st = {};
+    double var = 0;
+
+    std::sort(v.begin(), v.end());
+    for (double x : v)
+        st.mean += x / v.size();
+    for (double x : v)
+        var += (x - st.mean) * (x - st.mean) / v.size();
+
+    st.min = v.front();
+    st.median = v[v.size() / 2];
+    st.stddev = sqrt(var);
+    st.max = v.back();
+    return st;
+}
+
+// rate() returns the rate of one repetition in `unit`
+template <typename F>
+static void run_case(const std::string &group, const std::string &name, const std::string &params,
+                     const std::string &unit, unsigned reps, F rate)
+{
+    BenchCase c{group, name, params, unit, {}};
+
+    for (unsigned r = 0; r < reps; r++)
+        c.samples.push_back(rate());
+
+    const BenchStats st = bench_stats(c.samples);
+    printf("BENCH: %-10s %-36s %14.2f %-8s (min %.2f max %.2f sd %.2f)\n",
+           group.c_str(), name.c_str(), st.median, unit.c_str(), st.min, st.max, st.stddev);
+
+    g_cases.push_back(c);
+}
+
+static double seconds_since(high_resolution_clock::time_point t)
+{
+    return duration_cast<nanoseconds>(high_resolution_clock::now() - t).count() / 1e9;
+}
+
+static bool write_json(const char *path, const std::string &device, int epoch, unsigned reps)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp)
+    {
+        printf("BENCH: cannot write %s\n", path);
+        return false;
+    }
+
+    fprintf(fp, "{\n  \"device\": \"%s\",\n  \"epoch\": %d,\n  \"reps\": %u,\n  \"keccak_isa\": \"%s\",\n  \"results\": [\n",
+            device.c_str(), epoch, reps, keccak_isa(keccak_lanes()));
+
+    for (size_t i = 0; i < g_cases.size(); i++)
+    {
+        const BenchCase &c = g_cases[i];
+        const BenchStats st = bench_stats(c.samples);
+
+        fprintf(fp, "    {\"group\": \"%s\", \"name\": \"%s\", \"params\": {%s}, \"unit\": \"%s\", "
+                    "\"min\": %.3f, \"median\": %.3f, \"mean\": %.3f, \"stddev\": %.3f, \"max\": %.3f, \"samples\": [",
+                c.group.c_str(), c.name.c_str(), c.params.c_str(), c.unit.c_str(),
+                st.min, st.median, st.mean, st.stddev, st.max);
+        for (size_t s = 0; s < c.samples.size(); s++)
+            fprintf(fp, "%s%.3f", s ? ", " : "", c.samples[s]);
+        fprintf(fp, "]}%s\n", (i + 1 < g_cases.size()) ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+
+    return fclose(fp) == 0;
+}
+
+//------------------------------------------------------------------------------
+// host cases
+//------------------------------------------------------------------------------
+static void bench_keccak(unsigned reps)
+{
+    const unsigned n = 1 << 18;
+    uint64_t in[c_keccakMaxLanes][8] = {};
+    uint64_t out[c_keccakMaxLanes][8];
+    const uint64_t *pin[c_keccakMaxLanes];
+    uint64_t *pout[c_keccakMaxLanes];
+
+    for (unsigned l = 0; l < c_keccakMaxLanes; l++)
+    {
+        in[l][0] = l;
+        pin[l] = in[l];
+        pout[l] = out[l];
+    }
+
+    for (unsigned lanes = 1; lanes <= keccak_lanes(); lanes *= (lanes == 1) ? 4 : 2)
+    {
+        char name[64], params[64];
+        snprintf(name, sizeof(name), "keccak512 x%u %s", lanes, keccak_isa(lanes));
+        snprintf(params, sizeof(params), "\"lanes\": %u", lanes);
+
+        run_case("keccak", name, params, "Mh/s", reps, [&]() {
+            auto t = high_resolution_clock::now();
+            for (unsigned i = 0; i < n; i += lanes)
+            {
+                keccak_xn(pin, 8, pout, 8, 9, lanes);
+                in[0][1] = out[0][0]; // keep the calls dependent
+            }
+            return n / seconds_since(t) / 1e6;
+        });
+    }
+
+    run_case("keccak", "ethash::keccak512", "", "Mh/s", reps, [&]() {
+        ethash::hash512 h = {};
+        auto t = high_resolution_clock::now();
+        for (unsigned i = 0; i < n; i++)
+            h = ethash::keccak512(h.bytes, 64);
+        return n / seconds_since(t) / 1e6;
+    });
+}
+
+static void bench_hashimoto_light(int epoch, unsigned reps)
+{
+    const ethash::epoch_context &ec = ethash::get_global_epoch_context(epoch);
+    const ethash::hash256 header = {};
+    const unsigned n = 256;
+    uint64_t nonce = 0;
+
+    run_case("hashimoto", "light, 1 thread", "\"dag\": false", "kh/s", reps, [&]() {
+        auto t = high_resolution_clock::now();
+        for (unsigned i = 0; i < n; i++)
+            ethash::hash(ec, header, nonce++);
+        return n / seconds_since(t) / 1e3;
+    });
+}
+
+// the global full context of this thread must hold the whole DAG
+static void bench_hashimoto_full(int epoch, unsigned reps)
+{
+    const ethash::epoch_context_full &ec = ethash::get_global_epoch_context_full(epoch);
+    const ethash::hash256 header = {};
+    const unsigned n = 1 << 15;
+    uint64_t nonce = 0;
+
+    for (unsigned lanes = 4; lanes <= HostHashimoto().lanes(); lanes *= 2)
+    {
+        const HostHashimoto engine(lanes);
+        char name[64], params[64];
+        snprintf(name, sizeof(name), "full x%u %s, 1 thread", lanes, engine.isa());
+        snprintf(params, sizeof(params), "\"dag\": true, \"lanes\": %u", lanes);
+
+        // target 0, nothing is kept
+        run_case("hashimoto", name, params, "kh/s", reps, [&]() {
+            std::vector<ethash::search_result> sols;
+            auto t = high_resolution_clock::now();
+            engine.search(ec.full_dataset, ec.full_dataset_num_items, header, 0, nonce, n, sols);
+            nonce += n;
+            return n / seconds_since(t) / 1e3;
+        });
+    }
+
+    // device hits recomputed in bulk, all of them pass
+    const HostHashimoto engine;
+    ethash::hash256 boundary;
+    memset(boundary.bytes, 0xff, sizeof(boundary.bytes));
+    std::vector<ethash::search_result> hits;
+    engine.search(ec.full_dataset, ec.full_dataset_num_items, header, UINT64_MAX, 0, 4096, hits);
+
+    char name[64];
+    snprintf(name, sizeof(name), "cross-check x%u %s, 1 thread", engine.lanes(), engine.isa());
+    run_case("hashimoto", name, "\"dag\": true", "kh/s", reps, [&]() {
+        std::vector<ethash::search_result> sols = hits;
+        auto t = high_resolution_clock::now();
+        engine.cross_check(ec.full_dataset, ec.full_dataset_num_items, header, boundary, sols);
+        return hits.size() / seconds_since(t) / 1e3;
+    });
+}
+
+static void bench_host_dag(int epoch, uint32_t items, unsigned threads, unsigned reps)
+{
+    EpochContext ec;
+    EthBackend::get_context(epoch, ec);
+    items = std::min<uint32_t>(items, ec.dagNumItems);
+
+    std::vector<uint8_t> buf((uint64_t)items * 128);
+    uint8_t *parts[1] = {buf.data()};
+    HostDag gen(threads);
+
+    for (uint32_t chunk : {4096u, 16384u, 65536u, 262144u})
+    {
+        char name[64], params[64];
+        snprintf(name, sizeof(name), "host %s chunk %u", gen.isa(), chunk);
+        snprintf(params, sizeof(params), "\"chunk\": %u, \"threads\": %u", chunk, gen.threads());
+
+        run_case("dag", name, params, "items/s", reps, [&]() {
+            auto t = high_resolution_clock::now();
+            for (uint32_t start = 0; start < items; start += chunk)
+            {
+                uint8_t *p[1] = {parts[0] + (uint64_t)start * 128};
+                gen.generate(ec, start, std::min(items, start + chunk), p, 1);
+            }
+            return items / seconds_since(t);
+        });
+    }
+}
+
+static void bench_memcpy(unsigned reps)
+{
+    for (size_t size : {1u << 20, 16u << 20, 64u << 20})
+    {
+        std::vector<uint8_t> src(size, 1), dst(size);
+        char name[64], params[64];
+        snprintf(name, sizeof(name), "memcpy %zu MB", size >> 20);
+        snprintf(params, sizeof(params), "\"bytes\": %zu", size);
+
+        run_case("transfer", name, params, "GB/s", reps, [&]() {
+            auto t = high_resolution_clock::now();
+            memcpy(dst.data(), src.data(), size);
+            src[dst[size / 2] & 0xff]++;
+            return size / seconds_since(t) / 1e9;
+        });
+    }
+}
+
+//------------------------------------------------------------------------------
+// CPU backend
+//------------------------------------------------------------------------------
+static void bench_cpu(int epoch, unsigned threads, unsigned reps, bool doSearch, bool doHashimoto)
+{
+    EthCpuDev dev(threads, false);
+    if (!dev.load_kernel() || !dev.gen_dag(epoch))
+        return;
+
+    // target 1, nothing is found and every batch runs to the end
+    ethash::hash256 boundary = {};
+    boundary.bytes[7] = 1;
+    const ethash::hash256 header = {};
+    const unsigned maxThreads = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+    uint64_t nonce = 0;
+
+    if (doHashimoto)
+        bench_hashimoto_full(epoch, reps);
+    if (!doSearch)
+        return;
+
+    for (unsigned t : {1u, std::max(1u, maxThreads / 2), maxThreads})
+    {
+        for (unsigned batch : {4096u, 16384u})
+        {
+            EthCpuDev cpu(t, false);
+            cpu.set_params(batch);
+            cpu.load_kernel();
+            cpu.gen_dag(epoch); // shares the DAG built above
+
+            char name[64], params[64];
+            snprintf(name, sizeof(name), "cpu threads %u batch %u", t, batch);
+            snprintf(params, sizeof(params), "\"threads\": %u, \"batch\": %u", t, batch);
+
+            run_case("search", name, params, "Mh/s", reps, [&]() {
+                std::vector<ethash::search_result> sols;
+                auto s = high_resolution_clock::now();
+                uint64_t hashes = 0;
+                while (seconds_since(s) < 1.0)
+                {
+                    hashes += cpu.scan(nonce, cpu.batch_size(), header, boundary, sols);
+                    nonce += cpu.batch_size();
+                }
+                return hashes / seconds_since(s) / 1e6;
+            });
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// OpenCL backend
+//------------------------------------------------------------------------------
+// reaches into the DAG and queue internals to time parts of a DAG build
+class BenchDevce : public EthDevce
+{
+public:
+    BenchDevce(char *platform_name, char *knl_file, bool bBinary)
+        : EthDevce(platform_name, knl_file, bBinary, false) {}
+
+    // buffers of the whole DAG, light cache on the device
+    void setup_dag(int epoch)
+    {
+        alloc_dag(0, epoch);
+        upload_light(0, m_queue);
+    }
+    void run_dag(uint32_t workItems)
+    {
+        device_gen_dag(m_queue, 0, workItems);
+    }
+    // search a partly generated DAG, the rate does not depend on its content
+    void mark_dag()
+    {
+        m_dag[0].epoch = m_dag[0].ec.epochNumber;
+        m_activeDag = 0;
+    }
+    cl::Context &context() { return m_context; }
+    cl::CommandQueue &queue() { return m_queue; }
+};
+
+static double event_seconds(const cl::Event &ev)
+{
+    cl_int err;
+    const cl_ulong start = ev.getProfilingInfo<CL_PROFILING_COMMAND_START>(&err);
+    const cl_ulong end = ev.getProfilingInfo<CL_PROFILING_COMMAND_END>(&err);
+    return (end - start) / 1e9;
+}
+
+static bool bench_cl(char *platform, char *knl_file, int epoch, uint32_t dagItems, unsigned reps,
+                     bool doDag, bool doSearch, bool doTransfer)
+{
+    const bool binary = (strcmp(platform, "Xilinx") == 0);
+    // an xclbin is built for one work-group size
+    const std::vector<unsigned> lwsList = binary ? std::vector<unsigned>{128} : std::vector<unsigned>{64, 128, 256};
+
+    if (doDag)
+    {
+        for (unsigned groups : {100u, 1000u, 10000u, 20000u})
+        {
+            BenchDevce dev(platform, knl_file, binary);
+            dev.set_dag_chunk(groups);
+            if (!dev.load_kernel())
+                return false;
+            dev.setup_dag(epoch);
+
+            EpochContext ec;
+            EthBackend::get_context(epoch, ec);
+            const uint32_t items = std::min<uint32_t>(dagItems, ec.dagNumItems);
+
+            char name[64], params[64];
+            snprintf(name, sizeof(name), "GenerateDAG chunk %u groups", groups);
+            snprintf(params, sizeof(params), "\"chunk_groups\": %u, \"local_work_size\": 128", groups);
+
+            run_case("dag", name, params, "items/s", reps, [&]() {
+                auto t = high_resolution_clock::now();
+                dev.run_dag(items * 2);
+                return items / seconds_since(t);
+            });
+        }
+    }
+
+    if (doSearch)
+    {
+        ethash::hash256 boundary = {};
+        boundary.bytes[7] = 1;
+        const ethash::hash256 header = {};
+
+        for (unsigned lws : lwsList)
+        {
+            for (unsigned mult : {1024u, 4096u, 16384u, 65536u})
+            {
+                BenchDevce dev(platform, knl_file, binary);
+                dev.set_params(lws, mult, true);
+                if (!dev.load_kernel())
+                    return false;
+                dev.setup_dag(epoch);
+                dev.mark_dag();
+
+                char name[64], params[64];
+                snprintf(name, sizeof(name), "search lws %u mult %u", lws, mult);
+                snprintf(params, sizeof(params), "\"local_work_size\": %u, \"multiplier\": %u", lws, mult);
+
+                uint64_t nonce = 0;
+                run_case("search", name, params, "Mh/s", reps, [&]() {
+                    std::vector<ethash::search_result> sols;
+                    auto s = high_resolution_clock::now();
+                    uint64_t hashes = 0;
+                    while (seconds_since(s) < 1.0)
+                    {
+                        hashes += dev.scan(nonce, 4 * dev.batch_size(), header, boundary, sols);
+                        nonce += 4 * dev.batch_size();
+                    }
+                    return hashes / seconds_since(s) / 1e6;
+                });
+            }
+        }
+    }
+
+    if (doTransfer)
+    {
+        // one small batch per scan, what is left is the fixed cost of a launch
+        ethash::hash256 boundary = {};
+        boundary.bytes[7] = 1;
+        const ethash::hash256 header = {};
+        const unsigned launches = 200;
+
+        for (bool zeroCopy : {false, true})
+        {
+            BenchDevce dev(platform, knl_file, binary);
+            dev.set_params(lwsList[0], 16, true);
+            dev.set_zero_copy(zeroCopy);
+            if (!dev.load_kernel())
+                return false;
+            dev.setup_dag(epoch);
+            dev.mark_dag();
+
+            char name[64], params[64];
+            snprintf(name, sizeof(name), "launch %s", zeroCopy ? "zero-copy" : "copy");
+            snprintf(params, sizeof(params), "\"zero_copy\": %s, \"multiplier\": 16", zeroCopy ? "true" : "false");
+
+            uint64_t nonce = 0;
+            run_case("transfer", name, params, "us", reps, [&]() {
+                std::vector<ethash::search_result> sols;
+                auto t = high_resolution_clock::now();
+                for (unsigned i = 0; i < launches; i++)
+                {
+                    dev.scan(nonce, dev.batch_size(), header, boundary, sols);
+                    nonce += dev.batch_size();
+                }
+                return seconds_since(t) / launches * 1e6;
+            });
+        }
+
+        BenchDevce dev(platform, knl_file, binary);
+        if (!dev.load_kernel())
+            return false;
+
+        for (size_t size : {1u << 20, 16u << 20, 64u << 20})
+        {
+            std::vector<uint8_t> host(size, 1);
+            cl::Buffer buf(dev.context(), CL_MEM_READ_WRITE, size);
+            char name[64], params[64];
+
+            snprintf(name, sizeof(name), "write %zu MB", size >> 20);
+            snprintf(params, sizeof(params), "\"bytes\": %zu, \"dir\": \"h2d\"", size);
+            run_case("transfer", name, params, "GB/s", reps, [&]() {
+                cl::Event ev;
+                dev.queue().enqueueWriteBuffer(buf, CL_TRUE, 0, size, host.data(), nullptr, &ev);
+                return size / event_seconds(ev) / 1e9;
+            });
+
+            snprintf(name, sizeof(name), "read %zu MB", size >> 20);
+            snprintf(params, sizeof(params), "\"bytes\": %zu, \"dir\": \"d2h\"", size);
+            run_case("transfer", name, params, "GB/s", reps, [&]() {
+                cl::Event ev;
+                dev.queue().enqueueReadBuffer(buf, CL_TRUE, 0, size, host.data(), nullptr, &ev);
+                return size / event_seconds(ev) / 1e9;
+            });
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    int epoch = 0;
+    unsigned reps = 5;
+    unsigned threads = 0;
+    uint32_t dagItems = 1 << 20;
+    char *platform = nullptr;
+    char *knl_file = nullptr;
+    const char *json = nullptr;
+    std::string only = "keccak,hashimoto,dag,search,transfer";
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--cpu") == 0 && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--cl") == 0 && i + 2 < argc)
+        {
+            platform = argv[++i];
+            knl_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--epoch") == 0 && i + 1 < argc)
+            epoch = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc)
+            reps = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--dag-items") == 0 && i + 1 < argc)
+            dagItems = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--only") == 0 && i + 1 < argc)
+            only = argv[++i];
+        else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+            json = argv[++i];
+        else
+        {
+            usage(argv);
+            return EXIT_FAILURE;
+        }
+    }
+
+    auto enabled = [&](const char *group) { return only.find(group) != std::string::npos; };
+
+    if (enabled("keccak"))
+        bench_keccak(reps);
+    if (enabled("hashimoto"))
+        bench_hashimoto_light(epoch, reps);
+    if (enabled("dag"))
+        bench_host_dag(epoch, dagItems, threads, reps);
+
+    std::string device = "CPU";
+    if (platform)
+    {
+        device = platform;
+        if (!bench_cl(platform, knl_file, epoch, dagItems, reps,
+                      enabled("dag"), enabled("search"), enabled("transfer")))
+        {
+            std::cout << "No device available, run the CPU backend: " << argv[0] << " --cpu 0" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    else
+    {
+        // the full DAG is built once for both
+        if (enabled("search") || enabled("hashimoto"))
+            bench_cpu(epoch, threads, reps, enabled("search"), enabled("hashimoto"));
+        if (enabled("transfer"))
+            bench_memcpy(reps);
+    }
+
+    if (json && !write_json(json, device, epoch, reps))
+        return EXIT_FAILURE;
+
+    return 0;
+}
@@ -1,10 +1,51 @@
+#include <signal.h>
+
 #include "xleth.hpp"
+#include "cpudev.hpp"
+#include "scheduler.hpp"
+#include "session.hpp"
+#include "soak.hpp"
+#include "worksource.hpp"
+#include "metrics.hpp"
+
+// a soak run ends cleanly on Ctrl-C or a kill
+static Soak *s_soak = nullptr;
+
+static void stop_soak(int)
+{
+    if (s_soak)
+        s_soak->stop();
+}
 
 void usage(char **argv)
 {
     // 0: xilinx, 1: amd
     std::cout << "Usage: " << std::endl;
-    std::cout << argv[0] << " <epoch> <Xilinx|AMD> <kernel-file> [quiet]" << std::endl;
+    std::cout << argv[0] << " <epoch> <Xilinx|AMD> <kernel-file> [quiet] [--host-dag] [--devices N] [--metrics S] [--metrics-json FILE] [--tune] [--dag-parts N] [--instances K [--multi-queue]] [--zero-copy] [--light [--item-cache MB]] [--block-target HEX] [--trace FILE] [--jobs N] [--replay FILE [--shares FILE]] [--soak S [soak options]] [--extranonce HEX] [--checkpoint FILE]" << std::endl;
+    std::cout << argv[0] << " <epoch> CPU <threads> [quiet] [--devices N] [--light [--item-cache MB]] [--metrics S] [--metrics-json FILE] [--trace FILE] [--jobs N] [--replay FILE [--shares FILE]] [--soak S [soak options]] [--extranonce HEX] [--checkpoint FILE]" << std::endl;
+    std::cout << "  --devices N : search on N devices, 0 for all devices of the platform" << std::endl;
+    std::cout << "  --tune : search the best launch parameters of the device and save them" << std::endl;
+    std::cout << "  --dag-parts N : split the DAG into N buffers (1, 2, 4, 8), an xclbin needs its DAG_PARTS" << std::endl;
+    std::cout << "  --instances K : run K search kernels at once on an out-of-order queue (a compute unit each on Xilinx)" << std::endl;
+    std::cout << "  --multi-queue : give every instance its own in-order queue" << std::endl;
+    std::cout << "  --zero-copy : keep header and results in mapped host memory" << std::endl;
+    std::cout << "  --light : search without the DAG, items are computed from the light cache" << std::endl;
+    std::cout << "  --item-cache MB : keep the first MB of the DAG for a light search" << std::endl;
+    std::cout << "  --block-target HEX : also flag the hits below this block boundary in the same search, one OpenCL device only" << std::endl;
+    std::cout << "  --metrics S : print hash rate and launch timings every S seconds" << std::endl;
+    std::cout << "  --metrics-json FILE : also write them to FILE as JSON" << std::endl;
+    std::cout << "  --trace FILE : write a timeline of host phases and device commands as Chrome trace JSON" << std::endl;
+    std::cout << "  --jobs N : search N headers, a new one every 2 seconds, on one session" << std::endl;
+    std::cout << "  --replay FILE : search the jobs recorded in FILE (- for stdin), shares to --shares FILE" << std::endl;
+    std::cout << "  --soak S : search synthetic jobs for S seconds (0: until interrupted) and report the steady state" << std::endl;
+    std::cout << "  --job-ms MS : soak, a new header every MS milliseconds (default 10000)" << std::endl;
+    std::cout << "  --difficulty D[,D...] : soak, the difficulties of the jobs (default 1000000)" << std::endl;
+    std::cout << "  --diff-jobs N : soak, the next difficulty every N jobs" << std::endl;
+    std::cout << "  --epoch-jobs N : soak, roll the epoch over every N jobs" << std::endl;
+    std::cout << "  --record FILE : soak, write the jobs as a --replay file" << std::endl;
+    std::cout << "  --report S : soak and replay, print a status line every S seconds (default 60)" << std::endl;
+    std::cout << "  --extranonce HEX : fix the top bits of every nonce to the pool extranonce" << std::endl;
+    std::cout << "  --checkpoint FILE : keep the searched nonces of the job in FILE and resume from it" << std::endl;
 }
 
 int main(int argc, char **argv)
@@ -19,51 +60,230 @@ int main(int argc, char **argv)
         return EXIT_FAILURE;
     }
 
-    if (argc > 4)
-        debug = false;
+    bool host_dag = false;
+    bool tune = false;
+    int num_devices = 1;
+    int num_jobs = 0;
+    unsigned dag_parts = 2;
+    unsigned instances = 1;
+    bool multi_queue = false;
+    bool zero_copy = false;
+    bool light = false;
+    unsigned item_cache = 0;
+    std::string replay_file, shares_file;
+    unsigned metrics_interval = 0;
+    std::string metrics_json;
+    std::string trace_file;
+    std::string extranonce, checkpoint_file;
+    std::string block_target;
+    int soak_seconds = -1;
+    unsigned job_ms = 10000;
+    std::string difficulties = "1000000";
+    unsigned diff_jobs = 0, epoch_jobs = 0;
+    std::string record_file;
+    unsigned report_seconds = 60;
+    for (int i = 4; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--host-dag") == 0)
+            host_dag = true;
+        else if (strcmp(argv[i], "--tune") == 0)
+            tune = true;
+        else if (strcmp(argv[i], "--devices") == 0 && i + 1 < argc)
+            num_devices = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--dag-parts") == 0 && i + 1 < argc)
+            dag_parts = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--instances") == 0 && i + 1 < argc)
+            instances = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--multi-queue") == 0)
+            multi_queue = true;
+        else if (strcmp(argv[i], "--zero-copy") == 0)
+            zero_copy = true;
+        else if (strcmp(argv[i], "--light") == 0)
+            light = true;
+        else if (strcmp(argv[i], "--item-cache") == 0 && i + 1 < argc)
+            item_cache = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+            num_jobs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+            replay_file = argv[++i];
+        else if (strcmp(argv[i], "--shares") == 0 && i + 1 < argc)
+            shares_file = argv[++i];
+        else if (strcmp(argv[i], "--extranonce") == 0 && i + 1 < argc)
+            extranonce = argv[++i];
+        else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc)
+            checkpoint_file = argv[++i];
+        else if (strcmp(argv[i], "--soak") == 0 && i + 1 < argc)
+            soak_seconds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--job-ms") == 0 && i + 1 < argc)
+            job_ms = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--difficulty") == 0 && i + 1 < argc)
+            difficulties = argv[++i];
+        else if (strcmp(argv[i], "--diff-jobs") == 0 && i + 1 < argc)
+            diff_jobs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--epoch-jobs") == 0 && i + 1 < argc)
+            epoch_jobs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+            record_file = argv[++i];
+        else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc)
+            report_seconds = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--block-target") == 0 && i + 1 < argc)
+            block_target = argv[++i];
+        else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc)
+            metrics_interval = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--metrics-json") == 0 && i + 1 < argc)
+            metrics_json = argv[++i];
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            trace_file = argv[++i];
+        else
+            debug = false;
+    }
+
+    if (dag_parts != 1 && dag_parts != 2 && dag_parts != 4 && dag_parts != 8)
+    {
+        usage(argv);
+        return EXIT_FAILURE;
+    }
 
     epoch = atoi(argv[1]);
 
-    EthDevce eth_dev;
+    // from here on, the kernel build is part of the timeline
+    if (!trace_file.empty())
+        Tracer::instance().start();
+
+    // OpenCL devices are probed until load_kernel fails when all are asked for
+    bool all_devices = (num_devices <= 0);
+    unsigned max_devices = all_devices ? 64 : num_devices;
+    bool is_cpu = (strcmp(argv[2], "CPU") == 0);
+    if (is_cpu && all_devices)
+        max_devices = 1;
 
-    if (strcmp(argv[2], "Xilinx") == 0)
+    // the block boundary is the second target of one OpenCL search, the CPU
+    // backend, the scheduler and the job sessions only know one target
+    if (!block_target.empty() && (is_cpu || num_devices != 1 || num_jobs > 0 ||
+                                  !replay_file.empty() || soak_seconds >= 0))
     {
-        eth_dev = EthDevce(argv[2], argv[3], true, debug);
+        std::cout << "--block-target needs one OpenCL device and no --jobs, --replay or --soak" << std::endl;
+        return EXIT_FAILURE;
     }
-    else
-    {
-        eth_dev = EthDevce(argv[2], argv[3], false, debug);
 
-        unsigned localWorkSize = 128;
-        unsigned globalWorkSizeMultiplier = 65535;
-        bool no_exit = true;
+    // tuned launch parameters, per device name and driver version
+    std::string tune_file;
+    if (getenv("XLETH_TUNE_FILE"))
+        tune_file = getenv("XLETH_TUNE_FILE");
+    else if (getenv("HOME"))
+        tune_file = std::string(getenv("HOME")) + "/.xleth/tune.txt";
 
-        eth_dev.set_params(localWorkSize, globalWorkSizeMultiplier, false);
-    }
+    // binaries of kernels built from source
+    std::string cl_cache;
+    if (getenv("XLETH_CL_CACHE"))
+        cl_cache = getenv("XLETH_CL_CACHE");
+    else if (getenv("HOME"))
+        cl_cache = std::string(getenv("HOME")) + "/.xleth/cl";
 
-    std::cout << "-----------------------------------------------" << std::endl;
-    std::cout << "Loading OpenCL kernel ..." << std::endl;
-    std::cout << "-----------------------------------------------" << std::endl;
+    // light caches kept on disk, built once per epoch
+    EpochManager::instance().set_dir(getenv("XLETH_LIGHT_DIR"));
 
-    rv = eth_dev.load_kernel();
-    if (!rv)
+    std::vector<std::unique_ptr<EthBackend>> eth_devs;
+
+    for (unsigned d = 0; d < max_devices; d++)
     {
-        return 0;
+        std::unique_ptr<EthBackend> eth_dev;
+
+        if (is_cpu)
+        {
+            EthCpuDev *cpu_dev = new EthCpuDev(atoi(argv[3]), debug);
+            cpu_dev->set_light(light, (uint64_t)item_cache << 20);
+            eth_dev.reset(cpu_dev);
+        }
+        else if (strcmp(argv[2], "Xilinx") == 0)
+        {
+            EthDevce *cl_dev = new EthDevce(argv[2], argv[3], true, debug);
+
+            cl_dev->set_device(d);
+            cl_dev->set_tune_file(tune_file.c_str());
+            cl_dev->set_dag_cache(getenv("XLETH_DAG_DIR"));
+            cl_dev->set_host_dag(host_dag);
+            cl_dev->set_dag_parts(dag_parts);
+            cl_dev->set_instances(instances, multi_queue);
+            cl_dev->set_zero_copy(zero_copy);
+            cl_dev->set_light_search(light, (uint64_t)item_cache << 20);
+            eth_dev.reset(cl_dev);
+        }
+        else
+        {
+            EthDevce *cl_dev = new EthDevce(argv[2], argv[3], false, debug);
+
+            unsigned localWorkSize = 128;
+            unsigned globalWorkSizeMultiplier = 65535;
+            bool no_exit = true;
+
+            cl_dev->set_params(localWorkSize, globalWorkSizeMultiplier, false);
+            cl_dev->set_device(d);
+            cl_dev->set_tune_file(tune_file.c_str());
+            cl_dev->set_program_cache(cl_cache.c_str());
+            cl_dev->set_dag_cache(getenv("XLETH_DAG_DIR"));
+            cl_dev->set_host_dag(host_dag);
+            cl_dev->set_dag_parts(dag_parts);
+            cl_dev->set_instances(instances, multi_queue);
+            cl_dev->set_zero_copy(zero_copy);
+            cl_dev->set_light_search(light, (uint64_t)item_cache << 20);
+            eth_dev.reset(cl_dev);
+        }
+
+        std::cout << "-----------------------------------------------" << std::endl;
+        std::cout << "Loading " << eth_dev->name() << " kernel on device " << d << " ..." << std::endl;
+        std::cout << "-----------------------------------------------" << std::endl;
+
+        rv = eth_dev->load_kernel();
+        if (!rv)
+        {
+            if (all_devices && d > 0)
+                break;
+            std::cout << "No device available, use the CPU backend: " << argv[0] << " " << argv[1] << " CPU 0" << std::endl;
+            return EXIT_FAILURE;
+        }
+        eth_dev->disp_device();
+
+        EthDevce *cl_dev = dynamic_cast<EthDevce *>(eth_dev.get());
+        if (tune && cl_dev)
+        {
+            std::cout << "-----------------------------------------------" << std::endl;
+            std::cout << "Tuning device " << d << " ..." << std::endl;
+            std::cout << "-----------------------------------------------" << std::endl;
+            if (!cl_dev->tune(epoch))
+                return EXIT_FAILURE;
+        }
+        eth_devs.push_back(std::move(eth_dev));
     }
-    eth_dev.disp_device();
 
-    std::cout << "-----------------------------------------------" << std::endl;
-    std::cout << "Generating DAG ..." << std::endl;
-    std::cout << "-----------------------------------------------" << std::endl;
+    for (size_t d = 0; d < eth_devs.size(); d++)
+    {
+        std::cout << "-----------------------------------------------" << std::endl;
+        std::cout << "Generating DAG on device " << d << " ..." << std::endl;
+        std::cout << "-----------------------------------------------" << std::endl;
 
-    auto t_start = high_resolution_clock::now();
+        auto t_start = high_resolution_clock::now();
 
-    rv = eth_dev.gen_dag(epoch);
+        eth_devs[d]->set_dag_progress([](const DagProgress &p) {
+            printf("DAG: epoch %d %5.1f%%, %lu of %lu items, %.1fs, %.1fs left\n",
+                   p.epoch, 100.0 * p.done / p.total, p.done, p.total, p.seconds, p.eta);
+        });
+        rv = eth_devs[d]->gen_dag(epoch);
+
+        auto t_end = high_resolution_clock::now();
+        auto duration = duration_cast<microseconds>(t_end - t_start);
+        float ms = duration.count() / 1000;
+        printf("DAG: took %6.2f seconds.\n", ms / 1000);
+    }
+    printf("DAG: host light caches %.1f MB\n", EpochManager::instance().resident() / 1048576.0);
 
-    auto t_end = high_resolution_clock::now();
-    auto duration = duration_cast<microseconds>(t_end - t_start);
-    float ms = duration.count() / 1000;
-    printf("DAG: took %6.2f seconds.\n", ms / 1000);
+    EthBackend *eth_dev = eth_devs[0].get();
+
+    MetricsDumper dumper;
+    for (size_t d = 0; d < eth_devs.size(); d++)
+        dumper.add(std::string(eth_devs[d]->name()) + "#" + std::to_string(d), eth_devs[d]->get_metrics());
+    if (metrics_interval || !metrics_json.empty())
+        dumper.start(metrics_interval ? metrics_interval : 10, metrics_interval > 0, metrics_json);
 
     std::cout << "-----------------------------------------------" << std::endl;
     std::cout << "Searching ..." << std::endl;
@@ -78,27 +298,172 @@ int main(int argc, char **argv)
     hex_dump("header   : ", header.bytes, 32);
     hex_dump("boundary : ", boundary.bytes, 32);
 
-    int start_nonce = 0;
-    ethash::search_result r = eth_dev.search(start_nonce, seed, header, boundary);
+    uint64_t start_nonce = 0;
+    std::vector<ethash::search_result> sols;
+
+    // nonces of the session jobs, one job's range shared by its leases
+    NonceSpace nonce_space;
+    uint64_t max_batch = 1;
+    for (auto &dev : eth_devs)
+        max_batch = std::max(max_batch, dev->batch_size());
+    if (!nonce_space.set_extranonce(extranonce, max_batch))
+        return EXIT_FAILURE;
+    if (!checkpoint_file.empty())
+        nonce_space.set_checkpoint(checkpoint_file);
+
+    if (num_jobs > 0)
+    {
+        // job switches of a pool, the session keeps buffers and arguments
+        Verifier verifier([](uint64_t job, const ethash::search_result &r) {
+            printf("SES: job %lu nonce %lu\n", job, r.nonce);
+        });
+        Session session(*eth_dev, nullptr, debug);
+        session.set_verifier(&verifier);
+        session.set_nonce_space(&nonce_space);
+
+        for (int j = 0; j < num_jobs; j++)
+        {
+            header.bytes[31] = (uint8_t)j;
+            session.set_job(header, boundary, epoch, start_nonce);
+            std::this_thread::sleep_for(seconds(2));
+        }
+        session.stop();
+        verifier.stop();
+        nonce_space.save();
+        session.report();
+        verifier.report();
+
+        dumper.stop();
+        if (metrics_interval || !metrics_json.empty())
+            dumper.dump();
+        if (!trace_file.empty())
+            Tracer::instance().write(trace_file);
+        return 0;
+    }
+
+    if (!replay_file.empty() || soak_seconds >= 0)
+    {
+        SoakOptions options;
+        options.seconds = std::max(0, soak_seconds);
+        options.reportSeconds = report_seconds;
+
+        auto run_soak = [&](WorkSource &source) {
+            Soak soak(*eth_dev, source, options, debug);
+            soak.set_nonce_space(&nonce_space);
+
+            s_soak = &soak;
+            signal(SIGINT, stop_soak);
+            signal(SIGTERM, stop_soak);
+            const bool clean = soak.run();
+            signal(SIGINT, SIG_DFL);
+            signal(SIGTERM, SIG_DFL);
+            s_soak = nullptr;
+
+            nonce_space.save();
+            soak.report();
+            return clean;
+        };
+
+        bool clean;
+        if (!replay_file.empty())
+        {
+            // recorded jobs as they come
+            ReplaySource source(replay_file, shares_file);
+            if (!source.is_open())
+                return EXIT_FAILURE;
+            clean = run_soak(source);
+            printf("SRC: jobs %lu, shares %lu, dropped %lu\n", source.jobs(), source.shares(), source.dropped());
+        }
+        else
+        {
+            // a pool with header, difficulty and epoch changes
+            std::vector<uint64_t> diffs;
+            for (size_t pos = 0; pos < difficulties.size();)
+            {
+                size_t comma = difficulties.find(',', pos);
+                if (comma == std::string::npos)
+                    comma = difficulties.size();
+                diffs.push_back(strtoull(difficulties.substr(pos, comma - pos).c_str(), nullptr, 10));
+                pos = comma + 1;
+            }
+            SyntheticSource source(epoch, job_ms, diffs, diff_jobs, epoch_jobs);
+            if (!record_file.empty() && !source.record(record_file))
+                return EXIT_FAILURE;
+            clean = run_soak(source);
+        }
+
+        dumper.stop();
+        if (metrics_interval || !metrics_json.empty())
+            dumper.dump();
+        if (!trace_file.empty())
+            Tracer::instance().write(trace_file);
+        return clean ? 0 : EXIT_FAILURE;
+    }
+
+    // share and block hits of one pass, tagged per solution
+    EthDevce *cl_dev = dynamic_cast<EthDevce *>(eth_dev);
+    std::vector<uint32_t> targets;
+    ethash::hash256 block_boundary = {};
+    if (!block_target.empty() && eth_devs.size() == 1 && cl_dev)
+    {
+        if (block_target.compare(0, 2, "0x") == 0)
+            block_target = block_target.substr(2);
+        block_boundary = to_hash256(block_target);
+        hex_dump("block    : ", block_boundary.bytes, 32);
+        sols = cl_dev->search(start_nonce, header, boundary, block_boundary, targets);
+    }
+    else if (eth_devs.size() == 1)
+    {
+        sols = eth_dev->search(start_nonce, seed, header, boundary);
+    }
+    else
+    {
+        std::vector<EthBackend *> devs;
+        for (auto &dev : eth_devs)
+            devs.push_back(dev.get());
+
+        Scheduler sched(devs, debug);
+        sols = sched.run(header, boundary, start_nonce, UINT64_MAX - start_nonce, 1);
+        sched.report();
+    }
+
+    // final numbers of the run
+    dumper.stop();
+    if (metrics_interval || !metrics_json.empty())
+        dumper.dump();
+    if (!trace_file.empty())
+        Tracer::instance().write(trace_file);
 
     std::cout << "-----------------------------------------------" << std::endl;
     std::cout << "Check solution ..." << std::endl;
     std::cout << "-----------------------------------------------" << std::endl;
 
-    if (r.solution_found)
+    for (size_t i = 0; i < sols.size(); i++)
     {
+        ethash::search_result &r = sols[i];
         printf("Sol: nonce    : %lu\n", r.nonce);
         hex_dump("Sol: mix_hash : ", r.mix_hash.bytes, 32);
+        if (i < targets.size())
+            printf("Sol: targets  : %s%s\n", (targets[i] & c_primaryTarget) ? "share " : "",
+                   (targets[i] & c_secondaryTarget) ? "block" : "");
 
-        bool bValid = eth_dev.verify(header, r.mix_hash, r.nonce, boundary);
+        // a tagged hit is checked against every boundary it claims to meet
+        bool bValid = true;
+        if (i >= targets.size() || (targets[i] & c_primaryTarget))
+            bValid = eth_dev->verify(header, r.mix_hash, r.nonce, boundary);
+        if (i < targets.size() && (targets[i] & c_secondaryTarget))
+            bValid = bValid && eth_dev->verify(header, r.mix_hash, r.nonce, block_boundary);
         printf("Sol: %s\n", (bValid) ? "valid." : "invalid !!!");
-
-        printf("Sol: Hash rate %5.2f Mh \n", eth_dev.get_hashrate());
     }
-    else
+
+    if (sols.empty())
     {
         printf("do_search: no solution found !!!\n");
     }
+    else if (eth_devs.size() == 1)
+    {
+        printf("Sol: Hash rate %5.2f Mh \n", eth_dev->get_hashrate());
+    }
 
     return 0;
 }
@@ -0,0 +1,57 @@
+#!/bin/sh
+# U50 connectivity for a DAG split into N parts, see DAG_PARTS in kernel/ethash.cl,
+# and K search compute units, light 1 for kernels built with LIGHT_SEARCH
+#   gen_connectivity.sh <parts> [cus] [light] > connectivity.ini
+# HBM[0:4] holds the light cache and the search I/O, the DAG parts share
+# HBM[5:31] with up to 5 pseudo channels each. GenerateDAG writes every part
+# through the same banks search reads it from, every compute unit reads the
+# one DAG from there. A light search reads the light cache from HBM[0:4] too.
+N=${1:-2}
+K=${2:-1}
+L=${3:-0}
+case "$N" in
+1|2|4|8) ;;
+*) echo "parts has to be 1, 2, 4 or 8" >&2; exit 1 ;;
+esac
+case "$K" in
+[1-8]) ;;
+*) echo "cus has to be 1 to 8" >&2; exit 1 ;;
+esac
+
+W=$((27 / N))
+[ $W -gt 5 ] && W=5
+
+banks()
+{
+    first=$((5 + $1 * W))
+    echo "HBM[$first:$((first + W - 1))]"
+}
+
+echo "[connectivity]"
+if [ $K -gt 1 ]; then
+    names=search_1
+    k=2
+    while [ $k -le $K ]; do
+        names="$names.search_$k"
+        k=$((k + 1))
+    done
+    echo "nk=search:$K:$names"
+fi
+echo "sp=GenerateDAG_1._Cache:HBM[0:4]"
+p=0
+while [ $p -lt $N ]; do
+    echo "sp=GenerateDAG_1._DAG$p:$(banks $p)"
+    p=$((p + 1))
+done
+k=1
+while [ $k -le $K ]; do
+    echo "sp=search_$k.g_output:HBM[0:1]"
+    echo "sp=search_$k.g_header:HBM[2:4]"
+    [ "$L" = 1 ] && echo "sp=search_$k.g_cache:HBM[0:4]"
+    p=0
+    while [ $p -lt $N ]; do
+        echo "sp=search_$k._g_dag$p:$(banks $p)"
+        p=$((p + 1))
+    done
+    k=$((k + 1))
+done
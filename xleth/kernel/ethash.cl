@@ -68,6 +68,31 @@ uint amd_bitalign(uint src0, uint src1, uint src2)
 #error "WORKSIZE has to be a multiple of 4"
 #endif
 
+// The DAG is split over DAG_PARTS buffers, 1024-bit item i is item
+// i / DAG_PARTS of part i % DAG_PARTS. Every part sits in its own memory
+// bank, so the random reads of search spread over all of them.
+#ifndef DAG_PARTS
+#define DAG_PARTS 2
+#endif
+
+#if DAG_PARTS == 1
+#define DAG_PARAMS(T, d) T d##0
+#define DAG_SELECT(d, p) (d##0)
+#elif DAG_PARTS == 2
+#define DAG_PARAMS(T, d) T d##0, T d##1
+#define DAG_SELECT(d, p) ((p) ? d##1 : d##0)
+#elif DAG_PARTS == 4
+#define DAG_PARAMS(T, d) T d##0, T d##1, T d##2, T d##3
+#define DAG_SELECT(d, p) (((p) & 2) ? (((p) & 1) ? d##3 : d##2) : (((p) & 1) ? d##1 : d##0))
+#elif DAG_PARTS == 8
+#define DAG_PARAMS(T, d) T d##0, T d##1, T d##2, T d##3, T d##4, T d##5, T d##6, T d##7
+#define DAG_SELECT(d, p) (((p) & 4) ? \
+    (((p) & 2) ? (((p) & 1) ? d##7 : d##6) : (((p) & 1) ? d##5 : d##4)) : \
+    (((p) & 2) ? (((p) & 1) ? d##3 : d##2) : (((p) & 1) ? d##1 : d##0)))
+#else
+#error "DAG_PARTS has to be 1, 2, 4 or 8"
+#endif
+
 #define FNV_PRIME 0x01000193U
 
 static __constant uint2 const Keccak_f1600_RC[24] = {
@@ -227,6 +252,81 @@ typedef union {
 } compute_hash_share;
 
 
+typedef union _Node {
+    uint dwords[16];
+    uint2 qwords[8];
+    uint4 dqwords[4];
+    uint8 oqwords[2];
+} Node;
+
+static void SHA3_512(uint2 *s)
+{
+    uint2 st[25];
+
+    for (uint i = 0; i < 8; ++i)
+        st[i] = s[i];
+
+    st[8] = (uint2)(0x00000001, 0x80000000);
+
+    for (uint i = 9; i != 25; ++i)
+        st[i] = (uint2)(0);
+
+    KECCAK_PROCESS(st, 8, 8);
+
+    for (uint i = 0; i < 8; ++i)
+        s[i] = st[i];
+}
+
+// 512-bit DAG node NodeIdx from the light cache
+static void ComputeDAGNode(uint NodeIdx, __global const Node *Cache, uint light_size, Node *DAGNode)
+{
+    *DAGNode = Cache[NodeIdx % light_size];
+
+    DAGNode->dwords[0] ^= NodeIdx;
+    SHA3_512(DAGNode->qwords);
+
+    for (uint i = 0; i < 256; ++i) {
+        uint ParentIdx = fnv(NodeIdx ^ i, DAGNode->dwords[i & 15]) % light_size;
+        __global const Node *ParentNode = Cache + ParentIdx;
+
+#pragma unroll
+        for (uint x = 0; x < 4; ++x) {
+                DAGNode->dqwords[x] *= (uint4)(FNV_PRIME);
+                DAGNode->dqwords[x] ^= ParentNode->dqwords[x];
+        }
+    }
+
+    SHA3_512(DAGNode->qwords);
+}
+
+#ifdef LIGHT_SEARCH
+#if DAG_PARTS != 1
+#error "LIGHT_SEARCH keeps its cached items in one buffer, DAG_PARTS has to be 1"
+#endif
+
+// 256 bits of DAG item idx for lane thread_id: read when it is one of the
+// first cached_items GenerateDAG wrote, computed from the light cache
+// otherwise. The 4 lanes of a hash ask for the same item, lanes 0 and 1
+// compute its first node, lanes 2 and 3 the second.
+static uint8 LightDAGItem(uint idx, uint thread_id, __global const hash128_t *items, uint cached_items,
+                          __global const Node *Cache, uint light_size)
+{
+    if (idx < cached_items)
+        return items[idx].uint8s[thread_id];
+
+    Node DAGNode;
+    ComputeDAGNode(idx * 2 + thread_id / 2, Cache, light_size, &DAGNode);
+    return DAGNode.oqwords[thread_id & 1];
+}
+
+#define DAG_LOAD(idx) LightDAGItem((idx), thread_id, (__global hash128_t const*) _g_dag0, cached_items, \
+                                   (__global const Node *) g_cache, light_size)
+#else
+#define DAG_LOAD(idx) \
+    ((__global hash128_t const*) DAG_SELECT(_g_dag, (idx) % DAG_PARTS))[(idx) / DAG_PARTS].uint8s[thread_id]
+#endif
+
+
 #ifdef LEGACY
 
 #define MIX(x) \
@@ -236,11 +336,7 @@ do { \
     } \
     barrier(CLK_LOCAL_MEM_FENCE); \
     uint idx = buffer[hash_id]; \
-    __global hash128_t const* g_dag; \
-    g_dag = (__global hash128_t const*) _g_dag0; \
-    if (idx & 1) \
-        g_dag = (__global hash128_t const*) _g_dag1; \
-    mix = fnv(mix, g_dag[idx >> 1].uint8s[thread_id]); \
+    mix = fnv(mix, DAG_LOAD(idx)); \
 } while(0)
 
 #else
@@ -249,41 +345,72 @@ do { \
 do { \
     buffer[get_local_id(0)] = fnv(init0 ^ (a + x), ((uint *)&mix)[x]) % dag_size; \
     uint idx = buffer[lane_idx]; \
-    __global hash128_t const* g_dag; \
-    g_dag = (__global hash128_t const*) _g_dag0; \
-    if (idx & 1) \
-        g_dag = (__global hash128_t const*) _g_dag1; \
-    mix = fnv(mix, g_dag[idx >> 1].uint8s[thread_id]); \
+    mix = fnv(mix, DAG_LOAD(idx)); \
     mem_fence(CLK_LOCAL_MEM_FENCE); \
 } while(0)
 #endif
 
-// NOTE: This struct must match the one defined in CLMiner.cpp
+// NOTE: This struct must match the one defined in xleth.hpp
+struct SearchResult {
+    uint gid;
+    uint mix[8];
+    uint targets; // bit 0: target met, bit 1: secondary_target met
+    uint pad[6]; // pad to 16 words for easy indexing
+};
+
 struct SearchResults {
-    struct {
-        uint gid;
-        uint mix[8];
-        uint pad[7]; // pad to 16 words for easy indexing
-    } rslt[MAX_OUTPUTS];
+    struct SearchResult rslt[MAX_OUTPUTS];
     uint count;
     uint hashCount;
     uint abort;
 };
 
+#ifdef XILINX
+// No atomics: every work-group keeps its own hits after SearchResults,
+//   uint groupCount[get_num_groups(0)];
+//   struct SearchResult groupRslt[get_num_groups(0)][MAX_OUTPUTS];
+// groupCount is written by every group, an aborted one included, so
+// nothing has to be cleared between launches or in a new buffer. count only
+// flags that some group has hits.
+#define GROUP_COUNT(out) ((__global volatile uint *)((out) + 1))
+#define GROUP_RSLT(out) ((__global volatile struct SearchResult *)(GROUP_COUNT(out) + get_num_groups(0)))
+#endif
+
 __attribute__((reqd_work_group_size(WORKSIZE, 1, 1)))
 __kernel void search(
     __global volatile struct SearchResults* restrict g_output,
     __constant uint2 const* g_header,
-    __global ulong8 const* _g_dag0,
-    __global ulong8 const* _g_dag1,
+    DAG_PARAMS(__global ulong8 const*, _g_dag),
     uint dag_size,
     ulong start_nonce,
-    ulong target
+    ulong target,
+    ulong secondary_target
+#ifdef LIGHT_SEARCH
+    , __global uint16 const* g_cache,
+    uint light_size,
+    uint cached_items
+#endif
 )
 {
 #ifdef FAST_EXIT
+    // only the host raises abort, for a new job. A hit does not cut its batch
+    // short, a batch that was not aborted is searched whole.
+#ifdef XILINX
+    // one read for the whole group, the compaction below has barriers. The
+    // count of the batch the buffer held before must not stay behind.
+    __local uint aborted;
+    if (get_local_id(0) == 0) {
+        aborted = g_output->abort;
+        if (aborted)
+            GROUP_COUNT(g_output)[get_group_id(0)] = 0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (aborted)
+        return;
+#else
     if (g_output->abort)
         return;
+#endif
 #endif
 
     const uint thread_id = get_local_id(0) % 4;
@@ -406,82 +533,67 @@ __kernel void search(
         atomic_inc(&g_output->hashCount);
 #endif
 
-    if (as_ulong(as_uchar8(state[0]).s76543210) <= target) {
-#ifdef FAST_EXIT
-        atomic_inc(&g_output->abort);
-#endif
+    // a hit meets either target, pool shares and block candidates come from
+    // the same hashes
+    const ulong value = as_ulong(as_uchar8(state[0]).s76543210);
+    const uint targets = (value <= target) | ((value <= secondary_target) << 1);
+    const bool found = targets != 0;
+
+#ifdef XILINX // Xilinx has no atomic_inc
+    // compact the hits of the work-group: flags in local memory, work-item 0
+    // turns them into slots with a serial scan, every hit writes its record
+    const uint lid = get_local_id(0);
+    __local uint slots[WORKSIZE];
+
+    slots[lid] = found;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (lid == 0) {
+        uint hits = 0;
+        for (uint i = 0; i < WORKSIZE; i++) {
+            const uint f = slots[i];
+            slots[i] = hits;
+            hits += f;
+        }
+        // the true count, the host sees hits beyond MAX_OUTPUTS were dropped
+        GROUP_COUNT(g_output)[get_group_id(0)] = hits;
+        if (hits)
+            g_output->count = 1;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
 
-#ifdef XILINX // FIXME: Xilinx has no atomic_inc
-        uint slot = 0;
-        g_output->count = 1;
+    if (found && slots[lid] < MAX_OUTPUTS) {
+        __global volatile struct SearchResult *r =
+            GROUP_RSLT(g_output) + get_group_id(0) * MAX_OUTPUTS + slots[lid];
 #else
+    if (found) {
         uint slot = min(MAX_OUTPUTS - 1u, atomic_inc(&g_output->count));
+        __global volatile struct SearchResult *r = g_output->rslt + slot;
 #endif
-        g_output->rslt[slot].gid = gid;
-        g_output->rslt[slot].mix[0] = mixhash[0].s0;
-        g_output->rslt[slot].mix[1] = mixhash[0].s1;
-        g_output->rslt[slot].mix[2] = mixhash[1].s0;
-        g_output->rslt[slot].mix[3] = mixhash[1].s1;
-        g_output->rslt[slot].mix[4] = mixhash[2].s0;
-        g_output->rslt[slot].mix[5] = mixhash[2].s1;
-        g_output->rslt[slot].mix[6] = mixhash[3].s0;
-        g_output->rslt[slot].mix[7] = mixhash[3].s1;
+        r->gid = gid;
+        r->mix[0] = mixhash[0].s0;
+        r->mix[1] = mixhash[0].s1;
+        r->mix[2] = mixhash[1].s0;
+        r->mix[3] = mixhash[1].s1;
+        r->mix[4] = mixhash[2].s0;
+        r->mix[5] = mixhash[2].s1;
+        r->mix[6] = mixhash[3].s0;
+        r->mix[7] = mixhash[3].s1;
+        r->targets = targets;
     }
 }
 
-typedef union _Node {
-    uint dwords[16];
-    uint2 qwords[8];
-    uint4 dqwords[4];
-} Node;
-
-static void SHA3_512(uint2 *s)
-{
-    uint2 st[25];
-
-    for (uint i = 0; i < 8; ++i)
-        st[i] = s[i];
-
-    st[8] = (uint2)(0x00000001, 0x80000000);
-
-    for (uint i = 9; i != 25; ++i)
-        st[i] = (uint2)(0);
-
-    KECCAK_PROCESS(st, 8, 8);
-
-    for (uint i = 0; i < 8; ++i)
-        s[i] = st[i];
-}
-
-__kernel void GenerateDAG(uint start, __global const uint16 *_Cache, __global uint16 *_DAG0, __global uint16 *_DAG1, uint light_size)
+__kernel void GenerateDAG(uint start, __global const uint16 *_Cache, DAG_PARAMS(__global uint16 *, _DAG), uint light_size)
 {
     __global const Node *Cache = (__global const Node *) _Cache;
     uint NodeIdx = start + get_global_id(0);
 
-    Node DAGNode = Cache[NodeIdx % light_size];
-
-    DAGNode.dwords[0] ^= NodeIdx;
-    SHA3_512(DAGNode.qwords);
-
-    for (uint i = 0; i < 256; ++i) {
-        uint ParentIdx = fnv(NodeIdx ^ i, DAGNode.dwords[i & 15]) % light_size;
-        __global const Node *ParentNode = Cache + ParentIdx;
-
-#pragma unroll
-        for (uint x = 0; x < 4; ++x) {
-                DAGNode.dqwords[x] *= (uint4)(FNV_PRIME);
-                DAGNode.dqwords[x] ^= ParentNode->dqwords[x];
-        }
-    }
-
-    SHA3_512(DAGNode.qwords);
+    Node DAGNode;
+    ComputeDAGNode(NodeIdx, Cache, light_size, &DAGNode);
 
-    __global Node *DAG;
-    if (NodeIdx & 2)
-        DAG = (__global Node *) _DAG1;
-    else
-        DAG = (__global Node *) _DAG0;
-    NodeIdx &= ~2;
+    // both 512-bit halves of item NodeIdx / 2 go to the same part
+    const uint item = NodeIdx / 2;
+    __global Node *DAG = (__global Node *) DAG_SELECT(_DAG, item % DAG_PARTS);
     //if (NodeIdx < DAG_SIZE)
-    DAG[(NodeIdx / 2) | (NodeIdx & 1)] = DAGNode;
-}
\ No newline at end of file
+    DAG[(item / DAG_PARTS) * 2 + (NodeIdx & 1)] = DAGNode;
+}
@@ -0,0 +1,119 @@
+#include "backend.hpp"
+
+void hex_dump(const char *hdr, uint8_t *data, size_t len)
+{
+    auto *ptr = data;
+
+    printf("%s", hdr);
+
+    for (int i = 0; i < len; i++, ptr++)
+    {
+        if (i > 0 && i % 64 == 0)
+        {
+            printf("\n");
+        }
+        printf("%02x", *ptr);
+        if (i > 0 && (i%4) == 0)
+            printf(" ");
+    }
+    std::cout << std::endl;
+}
+
+uint64_t get_target_value(const ethash::hash256 &boundary)
+{
+    uint8_t tmp[8];
+    uint64_t *pval = (uint64_t *)tmp;
+
+    memcpy(tmp, boundary.bytes, 8);
+    std::reverse(tmp, tmp + sizeof(tmp));
+    const uint64_t target = *pval;
+
+    return target;
+}
+
+// EthBackend
+
+void EthBackend::dag_progress(int epoch, uint64_t done, uint64_t total, uint64_t resumed,
+                              steady_clock::time_point start)
+{
+    if (!m_onDagProgress)
+        return;
+
+    const steady_clock::time_point now = steady_clock::now();
+    if (done < total && done > resumed && now - m_dagReported < milliseconds(c_dagProgressMs))
+        return;
+    m_dagReported = now;
+
+    DagProgress progress;
+    progress.epoch = epoch;
+    progress.done = done;
+    progress.total = total;
+    progress.resumed = resumed;
+    progress.seconds = duration_cast<microseconds>(now - start).count() / 1e6;
+    // the items found done took no time, only the rate of this run counts
+    const uint64_t built = done - resumed;
+    progress.eta = built ? progress.seconds * (total - done) / built : 0;
+    m_onDagProgress(progress);
+}
+
+bool EthBackend::get_context(int epoch)
+{
+    return get_context(epoch, m_epochContext);
+}
+
+bool EthBackend::get_context(int epoch, EpochContext &ec, bool light)
+{
+    TraceScope trace("get_context");
+    if (trace.on())
+        trace.args = "\"epoch\": " + std::to_string(epoch) + ", \"light\": " + (light ? "true" : "false");
+
+    ec.epochNumber = epoch;
+    ec.lightNumItems = ethash::calculate_light_cache_num_items(epoch);
+    ec.lightSize = ethash::get_light_cache_size(ec.lightNumItems);
+    ec.dagNumItems = ethash::calculate_full_dataset_num_items(epoch);
+    ec.dagSize = ethash::get_full_dataset_size(ec.dagNumItems);
+
+    ec.light = light ? EpochManager::instance().get(epoch) : LightHandle();
+    ec.lightCache = ec.light ? ec.light->items.data() : nullptr;
+
+    return !light || ec.light;
+}
+
+bool EthBackend::verify(const ethash::hash256 &header, const ethash::hash256 &mix_hash, uint64_t nonce, const ethash::hash256 &boundary)
+{
+    LightHandle light = std::atomic_load(&m_verifyLight);
+    if (!light || light->ctx.epoch_number != m_epochContext.epochNumber)
+    {
+        light = EpochManager::instance().get(m_epochContext.epochNumber);
+        std::atomic_store(&m_verifyLight, light);
+    }
+    return ethash::verify(light->ctx, header, mix_hash, nonce, boundary);
+}
+
+size_t EthBackend::verify_solutions(const ethash::hash256 &header, const ethash::hash256 &boundary, std::vector<ethash::search_result> &sols)
+{
+    const size_t count = sols.size();
+    TraceScope trace("verify");
+    if (trace.on())
+        trace.args = "\"solutions\": " + std::to_string(count);
+
+    auto invalid = [&](const ethash::search_result &r) {
+        if (verify(header, r.mix_hash, r.nonce, boundary))
+            return false;
+        printf("Search: nonce %lu rejected by verify\n", r.nonce);
+        return true;
+    };
+    sols.erase(std::remove_if(sols.begin(), sols.end(), invalid), sols.end());
+
+    return count - sols.size();
+}
+
+float EthBackend::get_hashrate() noexcept
+{
+    return m_metrics.hashrate();
+}
+
+void EthBackend::update_hashrate(uint32_t _groupSize, uint32_t _increment) noexcept
+{
+    m_metrics.add_hashes(uint64_t(_groupSize) * _increment);
+}
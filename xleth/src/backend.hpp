@@ -0,0 +1,147 @@
+#ifndef _BACKEND_H
+#define _BACKEND_H
+
+#include <assert.h> /* assert */
+
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <atomic> 
+#include <functional>
+#include <memory>
+#include <thread>
+#include <memory.h>
+
+#include <ethash/ethash.hpp>
+#include <test/unittests/helpers.hpp>
+
+#include "metrics.hpp"
+#include "epochs.hpp"
+#include "trace.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+//------------------------------------------------------------------------------
+// ethash
+//------------------------------------------------------------------------------
+// diff = '0x{:064x}'.format((int(2**256/DIFFICULTY)))
+//DIFFICULTY = 100000000 
+#define DIF_100M "0x0000002af31dc4611873bf3f70834acdae9f0f4f534f5d60585a5f1c1a3ced1b"
+//DIFFICULTY = 200000000 
+#define DIF_200M "0x00000015798ee2308c39df9fb841a566d74f87a7a9a7aeb02c2d2f8e0d1e768d"
+//DIFFICULTY = 500000000 
+#define DIF_500M "0x000000089705f4136b4a59731680a88f8953030fdd7645e011abac9f387295d2"
+
+struct EpochContext
+{
+    // ethash::epoch_context m_ec;
+    int epochNumber;
+    int lightNumItems;
+    size_t lightSize;
+    // held while the DAG is built from it, released once it is on the device
+    LightHandle light;
+    const ethash_hash512 *lightCache;
+    int dagNumItems;
+    uint64_t dagSize;
+};
+
+// progress of a DAG build, in DAG items
+struct DagProgress
+{
+    int epoch;
+    uint64_t done;
+    uint64_t total;
+    uint64_t resumed; // items a resumed build found done
+    double seconds;   // since the build started
+    double eta;       // seconds left at the rate so far
+};
+
+typedef std::function<void(const DagProgress &progress)> DagProgressHandler;
+
+const unsigned c_dagProgressMs = 1000; // progress reports at most this often
+
+//------------------------------------------------------------------------------
+// backend
+//------------------------------------------------------------------------------
+// Common interface of the search devices (OpenCL, CPU). A backend owns the
+// DAG of one epoch and searches it for nonces below a boundary.
+class EthBackend
+{
+protected:
+    bool m_debug = false;
+
+    // hash rate, launch timings
+    Metrics m_metrics;
+
+    // ethash
+    struct EpochContext m_epochContext = {};
+
+    // set by abort(), scan() stops launching and returns early
+    std::atomic<bool> m_abort{false};
+    // nonces from the start of the last scan() searched completely and in
+    // order, an aborted scan may have hashed more with gaps
+    uint64_t m_searched = 0;
+
+    // light cache verify() checks against, std::atomic_load/store only
+    LightHandle m_verifyLight;
+
+    DagProgressHandler m_onDagProgress;
+    steady_clock::time_point m_dagReported;
+
+    // hand the progress of a build started at start to the handler, at most
+    // every c_dagProgressMs unless it is done
+    void dag_progress(int epoch, uint64_t done, uint64_t total, uint64_t resumed, steady_clock::time_point start);
+
+public:
+    virtual ~EthBackend() {}
+
+    virtual const char *name() const = 0;
+    virtual bool load_kernel() = 0;
+    virtual void disp_device() = 0;
+    virtual bool gen_dag(int epoch) = 0;
+    // search from start_nonce until a batch has hits, return all of its
+    // verified solutions in nonce order
+    virtual std::vector<ethash::search_result> search(uint64_t start_nonce, ethash::hash256 &seed, ethash::hash256 &header, ethash::hash256 &boundary) = 0;
+    // nonces hashed by one device launch, the unit of scan()
+    virtual uint64_t batch_size() const = 0;
+    // hash [start_nonce, start_nonce + count) in whole batches, append every
+    // hit to sols and return the number of hashes done
+    virtual uint64_t scan(uint64_t start_nonce, uint64_t count, const ethash::hash256 &header, const ethash::hash256 &boundary, std::vector<ethash::search_result> &sols) = 0;
+    uint64_t searched() const { return m_searched; }
+    // epoch of the DAG searched, -1 before gen_dag()
+    virtual int dag_epoch() const = 0;
+    // make the DAG of an epoch the searched one
+    virtual bool switch_dag(int epoch) { return dag_epoch() == epoch || gen_dag(epoch); }
+    // Stop a running scan() from any thread, the work it already launched may
+    // still finish. Stays set until clear_abort().
+    virtual void abort() { m_abort = true; }
+    void clear_abort() { m_abort = false; }
+    bool aborted() const { return m_abort; }
+
+    // called from the thread building the DAG, a background build included
+    void set_dag_progress(DagProgressHandler handler) { m_onDagProgress = handler; }
+
+    bool get_context(int epoch);
+    // sizes of an epoch, with a handle to its light cache when light is set
+    static bool get_context(int epoch, EpochContext &ec, bool light = true);
+    static void release_light(EpochContext &ec)
+    {
+        ec.light.reset();
+        ec.lightCache = nullptr;
+    }
+    bool verify(const ethash::hash256 &header, const ethash::hash256& mix_hash, uint64_t nonce, const ethash::hash256 &boundary);
+    // drop the hits that fail verification, return how many were dropped
+    size_t verify_solutions(const ethash::hash256 &header, const ethash::hash256 &boundary, std::vector<ethash::search_result> &sols);
+    float get_hashrate() noexcept;
+    void update_hashrate(uint32_t _groupSize, uint32_t _increment) noexcept;
+    const Metrics &get_metrics() const { return m_metrics; }
+    Metrics &get_metrics() { return m_metrics; }
+};
+
+void hex_dump(const char *hdr, uint8_t *data, size_t len);
+uint64_t get_target_value(const ethash::hash256 &boundary);
+
+#endif // _BACKEND_H
@@ -0,0 +1,247 @@
+#include <lib/ethash/ethash-internal.hpp>
+
+#include "cpudev.hpp"
+#include "hostdag.hpp"
+
+// EthCpuDev
+
+bool EthCpuDev::load_kernel()
+{
+    if (m_settings.threads == 0)
+        m_settings.threads = std::thread::hardware_concurrency();
+    if (m_settings.threads == 0)
+        m_settings.threads = 1;
+
+    m_hashimoto = HostHashimoto(m_settings.lanes);
+    m_loaded = true;
+
+    printf("CPU: THREADS    %u\n", m_settings.threads);
+    printf("CPU: BATCH      %u\n", m_settings.batchSize);
+    printf("CPU: HASHIMOTO  x%u %s\n", m_hashimoto.lanes(), m_hashimoto.isa());
+    if (m_settings.light)
+        printf("CPU: LIGHT      %u items cached\n", m_settings.cachedItems);
+
+    return m_loaded;
+}
+
+void EthCpuDev::disp_device()
+{
+    if (!m_loaded)
+    {
+        return;
+    }
+
+    std::cout << "DEV: Host threads     " << m_settings.threads << std::endl;
+}
+
+bool EthCpuDev::gen_dag(int epoch)
+{
+    if (!m_loaded)
+    {
+        std::cout << "Kernel is not loaded !!!" << std::endl;
+        return false;
+    }
+
+    if (m_settings.light)
+        return gen_light(epoch);
+
+    std::cout << "DAG: generating for epoch " << epoch << " ..." << std::endl;
+    // the full context brings its own light cache
+    get_context(epoch, m_epochContext, false);
+
+    printf("DAG: epoch %u lightSize %lu dagSize %lu\n",
+            epoch, m_epochContext.lightSize, m_epochContext.dagSize);
+
+    // several CPU backends share one dataset, only the first one to see an
+    // epoch fills it. The built context stays alive as long as it is the
+    // key, a context of a later epoch can not take over its address.
+    static std::mutex s_builtLock;
+    static int s_builtEpoch = -1;
+    static std::shared_ptr<ethash::epoch_context_full> s_built;
+    std::lock_guard<std::mutex> lock(s_builtLock);
+    if (s_built && s_builtEpoch == epoch)
+    {
+        m_fullContext = s_built;
+        printf("DAG: epoch %u already built\n", epoch);
+        return m_hashimoto.check(*m_fullContext, 2 * m_hashimoto.lanes());
+    }
+
+    // a full context allocates the dataset zeroed and fills it lazily on
+    // lookup, build every item here so search never stalls on it
+    m_fullContext = ethash::create_epoch_context_full(epoch);
+    if (!m_fullContext)
+    {
+        printf("DAG: epoch %u dataset allocation failed\n", epoch);
+        return false;
+    }
+    ethash_hash1024 *dataset = m_fullContext->full_dataset;
+
+    const uint32_t numItems = m_epochContext.dagNumItems;
+    const uint32_t chunk = m_settings.dagChunk;
+    HostDag gen(m_settings.threads);
+    const auto t_build = steady_clock::now();
+
+    for (uint32_t start = 0; start < numItems; start += chunk)
+    {
+        auto t_start = high_resolution_clock::now();
+        const uint32_t end = std::min(numItems, start + chunk);
+        TraceScope trace("host DAG chunk", "dag");
+        if (trace.on())
+            trace.args = "\"start\": " + std::to_string(start) + ", \"count\": " + std::to_string(end - start);
+
+        uint8_t *parts[1] = {dataset[start].bytes};
+        gen.generate(m_epochContext, start, end, parts, 1);
+        dag_progress(epoch, end, numItems, 0, t_build);
+
+        auto t_end = high_resolution_clock::now();
+
+        auto duration = duration_cast<microseconds>(t_end - t_start);
+        float ms = duration.count() / 1000;
+        if (m_debug)
+            printf("DAG: item %10u chunk %u, took %6.2fs\n", start, end - start, ms/1000);
+    }
+    s_built = m_fullContext;
+    s_builtEpoch = epoch;
+
+    // a lane mixup of the vector path shows up in the first nonces
+    return m_hashimoto.check(*m_fullContext, 2 * m_hashimoto.lanes());
+}
+
+bool EthCpuDev::gen_light(int epoch)
+{
+    // the light cache stays with the device, the DAG is never built
+    get_context(epoch, m_epochContext);
+    m_fullContext = nullptr;
+    m_light = m_epochContext.light;
+    if (!m_light)
+        return false;
+
+    const uint32_t cached = std::min<uint32_t>(m_settings.cachedItems, m_epochContext.dagNumItems);
+    printf("DAG: epoch %u lightSize %lu, light search with %u of %u items cached\n",
+           epoch, m_epochContext.lightSize, cached, m_epochContext.dagNumItems);
+
+    m_items.assign(cached, ethash_hash1024{});
+    if (cached)
+    {
+        TraceScope trace("host DAG chunk", "dag");
+        if (trace.on())
+            trace.args = "\"start\": 0, \"count\": " + std::to_string(cached);
+
+        HostDag gen(m_settings.threads);
+        uint8_t *parts[1] = {m_items[0].bytes};
+        gen.generate(m_epochContext, 0, cached, parts, 1);
+    }
+
+    return m_hashimoto.check_light(m_light->ctx, m_items.data(), cached, 2 * m_hashimoto.lanes());
+}
+
+uint64_t EthCpuDev::batch_size() const
+{
+    return (uint64_t)m_settings.threads * m_settings.batchSize;
+}
+
+uint64_t EthCpuDev::scan(uint64_t start_nonce, uint64_t count, const ethash::hash256 &header, const ethash::hash256 &boundary, std::vector<ethash::search_result> &sols)
+{
+    m_searched = 0;
+    if (!m_loaded || (!m_fullContext && !m_light))
+    {
+        std::cout << "DAG is not generated !!!" << std::endl;
+        return 0;
+    }
+
+    TraceScope trace("scan");
+    if (trace.on())
+        trace.args = "\"nonce\": " + std::to_string(start_nonce) + ", \"count\": " + std::to_string(count);
+
+    auto t_start = high_resolution_clock::now();
+    const unsigned threads = m_settings.threads;
+    const uint64_t perThread = (count + threads - 1) / threads;
+    const uint64_t target = get_target_value(boundary);
+    const ethash_hash1024 *dag = m_fullContext ? m_fullContext->full_dataset : nullptr;
+    const uint32_t numItems = m_fullContext ? m_fullContext->full_dataset_num_items : 0;
+    std::vector<std::vector<ethash::search_result>> found(threads);
+    std::vector<uint64_t> done(threads, 0);
+    const size_t first = sols.size();
+
+    m_metrics.job_started();
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&, t]() {
+            const uint64_t begin = start_nonce + std::min(count, t * perThread);
+            const uint64_t end = start_nonce + std::min(count, (t + 1) * perThread);
+            if (dag)
+                done[t] = m_hashimoto.search(dag, numItems, header, target, begin, end - begin, found[t], &m_abort);
+            else
+                done[t] = m_hashimoto.search_light(m_light->ctx, m_items.data(), m_items.size(), header, target,
+                                                   begin, end - begin, found[t], &m_abort);
+
+            // the 64-bit target passes a few hashes above the boundary
+            auto above = [&](const ethash::search_result &r) {
+                return !ethash::is_less_or_equal(r.final_hash, boundary);
+            };
+            found[t].erase(std::remove_if(found[t].begin(), found[t].end(), above), found[t].end());
+        });
+    }
+    for (auto &w : workers)
+        w.join();
+
+    // threads scan ascending sub-ranges, keep the hits in nonce order
+    for (auto &f : found)
+        sols.insert(sols.end(), f.begin(), f.end());
+
+    // no device events here, a batch is timed as the kernel
+    m_metrics.kernel.record(duration_cast<nanoseconds>(high_resolution_clock::now() - t_start).count());
+    m_metrics.add_solutions(sols.size() - first);
+
+    // each thread hashes its sub-range from the front, an aborted one stops
+    // the searched prefix
+    uint64_t hashes = 0;
+    bool inOrder = true;
+    for (unsigned t = 0; t < threads; t++)
+    {
+        hashes += done[t];
+        if (inOrder)
+            m_searched += done[t];
+        inOrder = inOrder && done[t] == std::min(count, (t + 1) * perThread) - std::min(count, t * perThread);
+    }
+    m_metrics.add_hashes(hashes);
+    return hashes;
+}
+
+size_t EthCpuDev::cross_check(const ethash::hash256 &header, const ethash::hash256 &boundary, std::vector<ethash::search_result> &sols) const
+{
+    if (!m_fullContext)
+        return 0;
+    return m_hashimoto.cross_check(m_fullContext->full_dataset, m_fullContext->full_dataset_num_items,
+                                   header, boundary, sols);
+}
+
+std::vector<ethash::search_result> EthCpuDev::search(uint64_t start_nonce, ethash::hash256 &/*seed*/, ethash::hash256 &header, ethash::hash256 &boundary)
+{
+    std::vector<ethash::search_result> sols;
+    uint64_t startNonce = start_nonce;
+
+    printf("Search: target 0x%lx\n", get_target_value(boundary));
+
+    m_metrics.resume();
+
+    do
+    {
+        if (!scan(startNonce, batch_size(), header, boundary, sols))
+            return {};
+
+        if (m_debug)
+            printf("Search: start nonce %12lu, hash count %lu\n", startNonce, batch_size());
+
+        startNonce += batch_size();
+
+        verify_solutions(header, boundary, sols);
+
+    } while (sols.empty());
+
+    printf("\nSearch: found %zu, nonce %lu\n", sols.size(), sols[0].nonce);
+
+    return sols;
+}
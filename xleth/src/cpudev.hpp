@@ -0,0 +1,74 @@
+#ifndef _CPUDEV_H
+#define _CPUDEV_H
+
+#include <memory>
+#include <thread>
+#include <mutex>
+
+#include "backend.hpp"
+#include "hashimoto.hpp"
+
+struct CPUSettings
+{
+    // inputs
+    unsigned threads = 0;        // 0: std::thread::hardware_concurrency()
+    unsigned batchSize = 16384;  // nonces per thread per round
+    unsigned dagChunk = 65536;   // DAG items per progress report
+    unsigned lanes = 0;          // nonces per hashimoto call, 0: the widest the host supports
+    bool light = false;          // compute the DAG items from the light cache
+    uint32_t cachedItems = 0;    // light search: the first DAG items generated and kept
+};
+
+//------------------------------------------------------------------------------
+// CPU
+//------------------------------------------------------------------------------
+// Native backend built on the ethash library. The full dataset is generated
+// by all threads up front and search splits each round over the threads, so
+// the host throughput is measurable and device results can be cross-checked
+// on machines without any OpenCL platform. Every thread hashes 4, 8 or 16
+// nonces per HostHashimoto call.
+class EthCpuDev : public EthBackend
+{
+protected:
+    CPUSettings m_settings;
+    bool m_loaded = false;
+    // shared with the other CPU backends searching the same epoch
+    std::shared_ptr<ethash::epoch_context_full> m_fullContext;
+    HostHashimoto m_hashimoto;
+    // light search: the epoch's light cache and the cached items
+    LightHandle m_light;
+    std::vector<ethash_hash1024> m_items;
+
+    bool gen_light(int epoch);
+
+public:
+    EthCpuDev(unsigned threads, bool debug)
+    {
+        m_settings.threads = threads;
+        m_debug = debug;
+    }
+    bool set_params(unsigned batchSize, unsigned lanes = 0)
+    {
+        m_settings.batchSize = batchSize;
+        m_settings.lanes = lanes;
+        return true;
+    }
+    // search from the light cache, the first cacheBytes of the DAG generated
+    void set_light(bool enable, uint64_t cacheBytes = 0)
+    {
+        m_settings.light = enable;
+        m_settings.cachedItems = (uint32_t)std::min<uint64_t>(cacheBytes / ethash::full_dataset_item_size, UINT32_MAX);
+    }
+    const char *name() const override { return "CPU"; }
+    bool load_kernel() override;
+    void disp_device() override;
+    bool gen_dag(int epoch) override;
+    std::vector<ethash::search_result> search(uint64_t start_nonce, ethash::hash256 &seed, ethash::hash256 &header, ethash::hash256 &boundary) override;
+    uint64_t batch_size() const override;
+    uint64_t scan(uint64_t start_nonce, uint64_t count, const ethash::hash256 &header, const ethash::hash256 &boundary, std::vector<ethash::search_result> &sols) override;
+    int dag_epoch() const override { return (m_fullContext || m_light) ? m_epochContext.epochNumber : -1; }
+    // recompute hits of another device over this DAG, drop the ones that differ
+    size_t cross_check(const ethash::hash256 &header, const ethash::hash256 &boundary, std::vector<ethash::search_result> &sols) const;
+};
+
+#endif // _CPUDEV_H
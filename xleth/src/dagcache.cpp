@@ -0,0 +1,235 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dagcache.hpp"
+
+static const char c_dagMagic[8] = {'X', 'L', 'E', 'T', 'H', 'D', 'A', 'G'};
+
+void make_dirs(const std::string &dir)
+{
+    for (size_t pos = dir.find('/', 1); ; pos = dir.find('/', pos + 1))
+    {
+        mkdir(dir.substr(0, pos).c_str(), 0755);
+        if (pos == std::string::npos)
+            break;
+    }
+}
+
+// DagCache
+
+std::string DagCache::path(int epoch, unsigned parts) const
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/epoch-%d-x%u.v%u.dag", epoch, parts, c_dagFileVersion);
+    return m_dir + name;
+}
+
+bool DagCache::map_file(const std::string &path, bool writable, size_t size, bool keep)
+{
+    // keep: reopen a file for writing as it is
+    const int flags = !writable ? O_RDONLY : keep ? O_RDWR : (O_RDWR | O_CREAT | O_TRUNC);
+    int fd = ::open(path.c_str(), flags, 0644);
+    if (fd < 0)
+        return false;
+
+    if (writable && !keep && ftruncate(fd, size) != 0)
+    {
+        printf("DAG: cache %s: %s\n", path.c_str(), strerror(errno));
+        ::close(fd);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size != size)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, size, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        printf("DAG: cache mmap %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    // the file is streamed to the device once, front to back
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    m_map = (uint8_t *)map;
+    m_mapSize = size;
+    return true;
+}
+
+bool DagCache::open(int epoch, int dagNumItems, const std::vector<uint64_t> &partSize)
+{
+    close();
+    if (!enabled() || partSize.size() > c_dagMaxParts)
+        return false;
+
+    size_t size = c_dagFileHeaderSize;
+    for (auto s : partSize)
+        size += s;
+
+    std::string file = path(epoch, partSize.size());
+    if (!map_file(file, false, size))
+        return false;
+
+    if (!valid_header(epoch, dagNumItems, partSize))
+    {
+        printf("DAG: cache %s is stale, ignored\n", file.c_str());
+        close();
+        return false;
+    }
+
+    m_partSize = partSize;
+    return true;
+}
+
+bool DagCache::valid_header(int epoch, int dagNumItems, const std::vector<uint64_t> &partSize) const
+{
+    const DagFileHeader *hdr = (const DagFileHeader *)m_map;
+    bool valid = memcmp(hdr->magic, c_dagMagic, sizeof(c_dagMagic)) == 0 &&
+                 hdr->version == c_dagFileVersion &&
+                 hdr->epoch == (uint32_t)epoch &&
+                 hdr->parts == partSize.size() &&
+                 hdr->dagNumItems == (uint32_t)dagNumItems;
+    for (size_t i = 0; valid && i < partSize.size(); i++)
+        valid = hdr->partSize[i] == partSize[i];
+    return valid;
+}
+
+bool DagCache::create(int epoch, int dagNumItems, const std::vector<uint64_t> &partSize)
+{
+    close();
+    if (!enabled() || partSize.size() > c_dagMaxParts)
+        return false;
+
+    make_dirs(m_dir);
+
+    size_t size = c_dagFileHeaderSize;
+    uint64_t dagSize = 0;
+    for (auto s : partSize)
+    {
+        size += s;
+        dagSize += s;
+    }
+
+    m_path = path(epoch, partSize.size());
+    m_tmpPath = m_path + ".tmp";
+    if (!map_file(m_tmpPath, true, size))
+    {
+        printf("DAG: cannot create cache %s\n", m_tmpPath.c_str());
+        m_tmpPath.clear();
+        return false;
+    }
+
+    DagFileHeader *hdr = (DagFileHeader *)m_map;
+    memset(hdr, 0, c_dagFileHeaderSize);
+    memcpy(hdr->magic, c_dagMagic, sizeof(c_dagMagic));
+    hdr->version = c_dagFileVersion;
+    hdr->epoch = epoch;
+    hdr->parts = partSize.size();
+    hdr->dagNumItems = dagNumItems;
+    hdr->dagSize = dagSize;
+    for (size_t i = 0; i < partSize.size(); i++)
+        hdr->partSize[i] = partSize[i];
+
+    m_partSize = partSize;
+    return true;
+}
+
+bool DagCache::resume(int epoch, int dagNumItems, const std::vector<uint64_t> &partSize, uint32_t &doneItems)
+{
+    close();
+    doneItems = 0;
+    if (!enabled() || partSize.size() > c_dagMaxParts)
+        return false;
+
+    size_t size = c_dagFileHeaderSize;
+    for (auto s : partSize)
+        size += s;
+
+    const std::string file = path(epoch, partSize.size());
+    const std::string tmp = file + ".tmp";
+    if (map_file(tmp, true, size, true))
+    {
+        const DagFileHeader *hdr = (const DagFileHeader *)m_map;
+        if (valid_header(epoch, dagNumItems, partSize) && hdr->doneItems <= (uint32_t)dagNumItems)
+        {
+            m_path = file;
+            m_tmpPath = tmp;
+            m_partSize = partSize;
+            doneItems = hdr->doneItems;
+            return true;
+        }
+        munmap(m_map, m_mapSize);
+        m_map = nullptr;
+        m_mapSize = 0;
+    }
+
+    return create(epoch, dagNumItems, partSize);
+}
+
+bool DagCache::mark_done(uint32_t doneItems)
+{
+    if (m_tmpPath.empty() || !m_map)
+        return false;
+
+    // the items reach the file before the header says they are there
+    if (msync(m_map, m_mapSize, MS_SYNC) != 0)
+        return false;
+    ((DagFileHeader *)m_map)->doneItems = doneItems;
+    return msync(m_map, c_dagFileHeaderSize, MS_SYNC) == 0;
+}
+
+bool DagCache::commit()
+{
+    if (m_tmpPath.empty() || !m_map)
+        return false;
+
+    bool ok = msync(m_map, m_mapSize, MS_SYNC) == 0;
+    munmap(m_map, m_mapSize);
+    m_map = nullptr;
+    m_mapSize = 0;
+
+    if (ok)
+        ok = rename(m_tmpPath.c_str(), m_path.c_str()) == 0;
+    if (!ok)
+    {
+        printf("DAG: cannot save cache %s: %s\n", m_path.c_str(), strerror(errno));
+        unlink(m_tmpPath.c_str());
+    }
+
+    m_tmpPath.clear();
+    return ok;
+}
+
+void DagCache::close()
+{
+    // an uncommitted file is incomplete, kept when a build can go on from it
+    const bool resumable = m_map && !m_tmpPath.empty() && ((const DagFileHeader *)m_map)->doneItems > 0;
+
+    if (m_map)
+        munmap(m_map, m_mapSize);
+    m_map = nullptr;
+    m_mapSize = 0;
+
+    if (!m_tmpPath.empty() && !resumable)
+        unlink(m_tmpPath.c_str());
+    m_tmpPath.clear();
+}
+
+uint8_t *DagCache::part(unsigned i) const
+{
+    uint8_t *p = m_map + c_dagFileHeaderSize;
+    for (unsigned k = 0; k < i; k++)
+        p += m_partSize[k];
+    return p;
+}
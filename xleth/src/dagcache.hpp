@@ -0,0 +1,79 @@
+#ifndef _DAGCACHE_H
+#define _DAGCACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+//------------------------------------------------------------------------------
+// DAG cache
+//------------------------------------------------------------------------------
+// A generated DAG is stored as one file per epoch and split layout, the
+// device buffers (_DAG0, _DAG1, ...) back to back after a page sized header.
+// Bump c_dagFileVersion whenever the layout of the items changes.
+const uint32_t c_dagFileVersion = 1;
+const size_t c_dagFileHeaderSize = 4096;
+const size_t c_dagMaxParts = 16;
+
+struct DagFileHeader
+{
+    char magic[8]; // "XLETHDAG"
+    uint32_t version;
+    uint32_t epoch;
+    uint32_t parts;
+    uint32_t dagNumItems;
+    uint64_t dagSize;
+    uint64_t partSize[c_dagMaxParts];
+    // items [0, doneItems) are complete in a file still being written, an
+    // interrupted build goes on from there
+    uint32_t doneItems;
+};
+
+class DagCache
+{
+protected:
+    std::string m_dir;
+    // mapping of the file currently open
+    uint8_t *m_map = nullptr;
+    size_t m_mapSize = 0;
+    std::vector<uint64_t> m_partSize;
+    // file being written by create(), renamed by commit()
+    std::string m_tmpPath;
+    std::string m_path;
+
+    bool map_file(const std::string &path, bool writable, size_t size, bool keep = false);
+    bool valid_header(int epoch, int dagNumItems, const std::vector<uint64_t> &partSize) const;
+
+public:
+    DagCache() {}
+    explicit DagCache(const std::string &dir) : m_dir(dir) {}
+    DagCache(const DagCache &) = delete;
+    DagCache &operator=(const DagCache &) = delete;
+    ~DagCache() { close(); }
+
+    void set_dir(const std::string &dir) { m_dir = dir; }
+
+    bool enabled() const { return !m_dir.empty(); }
+    std::string path(int epoch, unsigned parts) const;
+
+    // map the DAG of the epoch read only, false if missing or stale
+    bool open(int epoch, int dagNumItems, const std::vector<uint64_t> &partSize);
+    // create a writable mapping to be filled from the device
+    bool create(int epoch, int dagNumItems, const std::vector<uint64_t> &partSize);
+    // create(), or reopen the file an interrupted build of the same epoch
+    // and layout left, doneItems are the items it has
+    bool resume(int epoch, int dagNumItems, const std::vector<uint64_t> &partSize, uint32_t &doneItems);
+    // flush the items written so far and record [0, doneItems) as complete
+    bool mark_done(uint32_t doneItems);
+    // flush and atomically publish a file made by create()
+    bool commit();
+    void close();
+
+    uint8_t *part(unsigned i) const;
+    uint64_t part_size(unsigned i) const { return m_partSize[i]; }
+};
+
+// mkdir -p
+void make_dirs(const std::string &dir);
+
+#endif // _DAGCACHE_H
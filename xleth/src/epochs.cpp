@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include <lib/ethash/ethash-internal.hpp>
+
+#include "epochs.hpp"
+#include "dagcache.hpp"
+#include "trace.hpp"
+
+static const char c_lightMagic[8] = {'X', 'L', 'E', 'T', 'H', 'L', 'C', '1'};
+// prebuilt caches nobody took yet, the oldest goes first
+static const size_t c_maxPinned = 2;
+
+struct LightFileHeader
+{
+    char magic[8]; // "XLETHLC1"
+    int32_t epoch;
+    int32_t numItems;
+};
+
+// LightCache
+
+LightCache::LightCache(int epoch, std::vector<ethash_hash512> &&cache)
+    : items(std::move(cache)),
+      ctx{epoch, (int)items.size(), items.data(), nullptr, ethash::calculate_full_dataset_num_items(epoch)}
+{
+}
+
+// EpochManager
+
+EpochManager::~EpochManager()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_quit = true;
+    }
+    m_wake.notify_all();
+    for (auto &w : m_workers)
+        w.join();
+}
+
+EpochManager &EpochManager::instance()
+{
+    static EpochManager s_manager;
+    return s_manager;
+}
+
+void EpochManager::set_dir(const char *dir)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_dir = dir ? dir : "";
+}
+
+void EpochManager::set_threads(unsigned threads)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_threads = std::max(1u, threads);
+}
+
+LightHandle EpochManager::get(int epoch)
+{
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        for (;;)
+        {
+            auto pinned = m_pinned.find(epoch);
+            if (pinned != m_pinned.end())
+            {
+                // the caller owns it from now on
+                LightHandle h = pinned->second;
+                m_pinned.erase(pinned);
+                return h;
+            }
+            LightHandle h = m_live[epoch].lock();
+            if (h)
+                return h;
+            if (!m_building.count(epoch))
+                break;
+            m_built.wait(lock);
+        }
+        m_building.insert(epoch);
+    }
+
+    return build(epoch);
+}
+
+LightHandle EpochManager::build(int epoch)
+{
+    std::vector<ethash_hash512> cache;
+    TraceScope trace("light cache");
+
+    auto t_start = std::chrono::steady_clock::now();
+    const bool loaded = load(epoch, cache);
+    if (!loaded)
+    {
+        // every item hashes the one before, one cache is one thread
+        cache.resize(ethash::calculate_light_cache_num_items(epoch));
+        ethash::build_light_cache(cache.data(), (int)cache.size(), ethash::calculate_epoch_seed(epoch));
+        save(epoch, cache);
+    }
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t_start).count();
+    printf("DAG: light cache of epoch %d %s in %ld ms\n", epoch, loaded ? "loaded" : "built", (long)ms);
+    if (trace.on())
+        trace.args = "\"epoch\": " + std::to_string(epoch) + ", \"loaded\": " + (loaded ? "true" : "false");
+
+    LightHandle h = std::make_shared<const LightCache>(epoch, std::move(cache));
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_live[epoch] = h;
+        m_building.erase(epoch);
+
+        // drop entries of caches already freed
+        for (auto it = m_live.begin(); it != m_live.end();)
+            it = it->second.expired() ? m_live.erase(it) : std::next(it);
+    }
+    m_built.notify_all();
+    return h;
+}
+
+void EpochManager::prebuild(int epoch)
+{
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        if (m_pinned.count(epoch) || m_building.count(epoch) || !m_live[epoch].expired() ||
+            std::find(m_todo.begin(), m_todo.end(), epoch) != m_todo.end())
+            return;
+        m_todo.push_back(epoch);
+
+        while (m_workers.size() < m_threads)
+            m_workers.emplace_back(&EpochManager::worker, this);
+    }
+    m_wake.notify_one();
+}
+
+void EpochManager::worker()
+{
+    for (;;)
+    {
+        int epoch;
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            m_wake.wait(lock, [&]() { return m_quit || !m_todo.empty(); });
+            if (m_quit)
+                break;
+            epoch = m_todo.front();
+            m_todo.pop_front();
+        }
+
+        LightHandle h = get(epoch);
+
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_pinned[epoch] = h;
+        while (m_pinned.size() > c_maxPinned)
+            m_pinned.erase(m_pinned.begin());
+    }
+}
+
+size_t EpochManager::resident() const
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    size_t bytes = 0;
+    for (auto &it : m_live)
+    {
+        LightHandle h = it.second.lock();
+        if (h)
+            bytes += h->size();
+    }
+    return bytes;
+}
+
+bool EpochManager::load(int epoch, std::vector<ethash_hash512> &cache) const
+{
+    std::string dir;
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        dir = m_dir;
+    }
+    if (dir.empty())
+        return false;
+
+    const std::string path = dir + "/light-" + std::to_string(epoch) + ".bin";
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp)
+        return false;
+
+    LightFileHeader hdr;
+    const int numItems = ethash::calculate_light_cache_num_items(epoch);
+    bool ok = fread(&hdr, sizeof(hdr), 1, fp) == 1 &&
+              memcmp(hdr.magic, c_lightMagic, sizeof(c_lightMagic)) == 0 &&
+              hdr.epoch == epoch && hdr.numItems == numItems;
+    if (ok)
+    {
+        cache.resize(numItems);
+        ok = fread(cache.data(), sizeof(ethash_hash512), numItems, fp) == (size_t)numItems;
+    }
+    fclose(fp);
+
+    if (!ok)
+        printf("DAG: ignoring bad light cache %s\n", path.c_str());
+    return ok;
+}
+
+bool EpochManager::save(int epoch, const std::vector<ethash_hash512> &cache) const
+{
+    std::string dir;
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        dir = m_dir;
+    }
+    if (dir.empty())
+        return false;
+
+    make_dirs(dir);
+
+    const std::string path = dir + "/light-" + std::to_string(epoch) + ".bin";
+    const std::string tmp = path + ".tmp" + std::to_string((unsigned long)getpid());
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if (!fp)
+    {
+        printf("DAG: cannot write %s\n", tmp.c_str());
+        return false;
+    }
+
+    LightFileHeader hdr;
+    memcpy(hdr.magic, c_lightMagic, sizeof(c_lightMagic));
+    hdr.epoch = epoch;
+    hdr.numItems = (int32_t)cache.size();
+
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+              fwrite(cache.data(), sizeof(ethash_hash512), cache.size(), fp) == cache.size();
+    ok = (fclose(fp) == 0) && ok;
+    ok = ok && rename(tmp.c_str(), path.c_str()) == 0;
+    if (!ok)
+    {
+        printf("DAG: cannot write %s\n", path.c_str());
+        remove(tmp.c_str());
+    }
+    return ok;
+}
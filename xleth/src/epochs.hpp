@@ -0,0 +1,75 @@
+#ifndef _EPOCHS_H
+#define _EPOCHS_H
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ethash/ethash.hpp>
+
+//------------------------------------------------------------------------------
+// epoch manager
+//------------------------------------------------------------------------------
+// Light caches owned by the handles given out for them. A cache lives as long
+// as a DAG build, a verifier or a prebuild holds it and is freed with the
+// last handle, so a device that has its DAG keeps no light cache on the host.
+
+struct LightCache
+{
+    std::vector<ethash_hash512> items;
+    // view for ethash::hash() and verify(), without the L1 cache of ProgPoW
+    const ethash::epoch_context ctx;
+
+    LightCache(int epoch, std::vector<ethash_hash512> &&cache);
+    size_t size() const { return items.size() * sizeof(ethash_hash512); }
+};
+
+typedef std::shared_ptr<const LightCache> LightHandle;
+
+class EpochManager
+{
+protected:
+    mutable std::mutex m_lock;
+    std::condition_variable m_built;
+    std::map<int, std::weak_ptr<const LightCache>> m_live;
+    std::map<int, LightHandle> m_pinned; // prebuilt, until get() takes them
+    std::set<int> m_building;
+    std::string m_dir;
+
+    std::vector<std::thread> m_workers;
+    std::condition_variable m_wake;
+    std::deque<int> m_todo;
+    unsigned m_threads = 2;
+    bool m_quit = false;
+
+    LightHandle build(int epoch);
+    bool load(int epoch, std::vector<ethash_hash512> &cache) const;
+    bool save(int epoch, const std::vector<ethash_hash512> &cache) const;
+    void worker();
+
+public:
+    ~EpochManager();
+
+    // shared by all backends of the process
+    static EpochManager &instance();
+
+    // keep built caches in dir, "" to not keep them
+    void set_dir(const char *dir);
+    // prebuild threads, every one builds a different epoch
+    void set_threads(unsigned threads);
+
+    // the light cache of an epoch, built or loaded now unless someone holds it
+    LightHandle get(int epoch);
+    // build an epoch ahead of time on the pool, kept until get() takes it
+    void prebuild(int epoch);
+    // host bytes of all light caches alive
+    size_t resident() const;
+};
+
+#endif // _EPOCHS_H
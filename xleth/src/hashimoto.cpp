@@ -0,0 +1,435 @@
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HASHIMOTO_X86 1
+#endif
+
+#include <lib/ethash/ethash-internal.hpp>
+
+#include "hashimoto.hpp"
+
+static const uint32_t c_accesses = 64;
+static const uint32_t c_mixWords = 32; // 32-bit words of a 1024-bit mix
+// word offsets of every item fit the int32 index of a gather
+static const uint32_t c_gatherItems = 1u << 26;
+
+// keccak_xn() over n messages in runs of the widest Keccak of the host
+static void keccak_runs(const uint64_t *const in[], unsigned inWords, uint64_t *const out[],
+                        unsigned outWords, unsigned rateWords, unsigned n)
+{
+    const unsigned k = std::min(keccak_lanes(), n);
+    for (unsigned l = 0; l < n; l += k)
+        keccak_xn(in + l, inWords, out + l, outWords, rateWords, k);
+}
+
+// 64 DAG accesses of every seed and the compressed 256-bit mix, lanes
+// interleaved so their random DAG reads overlap
+static void mix_x1(const ethash_hash1024 *dag, uint32_t numItems, const ethash_hash512 seed[],
+                   ethash::hash256 cmix[], unsigned lanes)
+{
+    ethash_hash1024 mix[c_hashimotoMaxLanes];
+
+    for (unsigned l = 0; l < lanes; l++)
+        for (unsigned w = 0; w < c_mixWords; w++)
+            mix[l].word32s[w] = seed[l].word32s[w % 16];
+
+    for (uint32_t i = 0; i < c_accesses; i++)
+    {
+        for (unsigned l = 0; l < lanes; l++)
+        {
+            const uint32_t p = fnv1(i ^ seed[l].word32s[0], mix[l].word32s[i % c_mixWords]) % numItems;
+            for (unsigned w = 0; w < c_mixWords; w++)
+                mix[l].word32s[w] = fnv1(mix[l].word32s[w], dag[p].word32s[w]);
+        }
+    }
+
+    for (unsigned l = 0; l < lanes; l++)
+        for (unsigned k = 0; k < 8; k++)
+            cmix[l].word32s[k] = fnv1(fnv1(fnv1(mix[l].word32s[4 * k], mix[l].word32s[4 * k + 1]),
+                                           mix[l].word32s[4 * k + 2]), mix[l].word32s[4 * k + 3]);
+}
+
+// mix_x1() with every item past cachedItems computed from the light cache,
+// the item computation costs far more than the vector mix would save
+static void mix_light(const ethash::epoch_context &ctx, const ethash_hash1024 *items, uint32_t cachedItems,
+                      const ethash_hash512 seed[], ethash::hash256 cmix[], unsigned lanes)
+{
+    const uint32_t numItems = ctx.full_dataset_num_items;
+    ethash_hash1024 mix[c_hashimotoMaxLanes];
+
+    for (unsigned l = 0; l < lanes; l++)
+        for (unsigned w = 0; w < c_mixWords; w++)
+            mix[l].word32s[w] = seed[l].word32s[w % 16];
+
+    for (uint32_t i = 0; i < c_accesses; i++)
+    {
+        for (unsigned l = 0; l < lanes; l++)
+        {
+            const uint32_t p = fnv1(i ^ seed[l].word32s[0], mix[l].word32s[i % c_mixWords]) % numItems;
+            const ethash_hash1024 item = p < cachedItems ? items[p] : ethash::calculate_dataset_item_1024(ctx, p);
+            for (unsigned w = 0; w < c_mixWords; w++)
+                mix[l].word32s[w] = fnv1(mix[l].word32s[w], item.word32s[w]);
+        }
+    }
+
+    for (unsigned l = 0; l < lanes; l++)
+        for (unsigned k = 0; k < 8; k++)
+            cmix[l].word32s[k] = fnv1(fnv1(fnv1(mix[l].word32s[4 * k], mix[l].word32s[4 * k + 1]),
+                                           mix[l].word32s[4 * k + 2]), mix[l].word32s[4 * k + 3]);
+}
+
+#ifdef HASHIMOTO_X86
+
+#define A2_FNV(u, v) _mm256_xor_si256(_mm256_mullo_epi32((u), prime), (v))
+
+// mix[w] holds word w of the 8 mixes
+__attribute__((target("avx2")))
+static void mix_avx2(const ethash_hash1024 *dag, uint32_t numItems, const ethash_hash512 seed[],
+                     ethash::hash256 cmix[])
+{
+    const __m256i prime = _mm256_set1_epi32(FNV_PRIME);
+    const int *words = (const int *)dag;
+    const bool gather = numItems < c_gatherItems;
+    alignas(32) uint32_t lane[8];
+    __m256i mix[c_mixWords];
+
+    for (unsigned w = 0; w < 16; w++)
+    {
+        for (unsigned l = 0; l < 8; l++)
+            lane[l] = seed[l].word32s[w];
+        mix[w] = mix[w + 16] = _mm256_load_si256((const __m256i *)lane);
+    }
+    const __m256i init = mix[0];
+
+    for (uint32_t i = 0; i < c_accesses; i++)
+    {
+        _mm256_store_si256((__m256i *)lane, A2_FNV(_mm256_xor_si256(_mm256_set1_epi32(i), init), mix[i % c_mixWords]));
+        for (unsigned l = 0; l < 8; l++)
+            lane[l] = lane[l] % numItems;
+
+        if (gather)
+        {
+            for (unsigned l = 0; l < 8; l++)
+                lane[l] *= c_mixWords;
+            const __m256i off = _mm256_load_si256((const __m256i *)lane);
+            for (unsigned w = 0; w < c_mixWords; w++)
+                mix[w] = A2_FNV(mix[w], _mm256_i32gather_epi32(words + w, off, 4));
+        }
+        else
+        {
+            alignas(32) uint32_t item[8];
+            for (unsigned w = 0; w < c_mixWords; w++)
+            {
+                for (unsigned l = 0; l < 8; l++)
+                    item[l] = dag[lane[l]].word32s[w];
+                mix[w] = A2_FNV(mix[w], _mm256_load_si256((const __m256i *)item));
+            }
+        }
+    }
+
+    for (unsigned k = 0; k < 8; k++)
+    {
+        _mm256_store_si256((__m256i *)lane, A2_FNV(A2_FNV(A2_FNV(mix[4 * k], mix[4 * k + 1]),
+                                                          mix[4 * k + 2]), mix[4 * k + 3]));
+        for (unsigned l = 0; l < 8; l++)
+            cmix[l].word32s[k] = lane[l];
+    }
+}
+
+#define A5_FNV(u, v) _mm512_xor_si512(_mm512_mullo_epi32((u), prime), (v))
+
+// mix[w] holds word w of the 16 mixes
+__attribute__((target("avx512f")))
+static void mix_avx512(const ethash_hash1024 *dag, uint32_t numItems, const ethash_hash512 seed[],
+                       ethash::hash256 cmix[])
+{
+    const __m512i prime = _mm512_set1_epi32(FNV_PRIME);
+    const int *words = (const int *)dag;
+    const bool gather = numItems < c_gatherItems;
+    alignas(64) uint32_t lane[16];
+    __m512i mix[c_mixWords];
+
+    for (unsigned w = 0; w < 16; w++)
+    {
+        for (unsigned l = 0; l < 16; l++)
+            lane[l] = seed[l].word32s[w];
+        mix[w] = mix[w + 16] = _mm512_load_si512(lane);
+    }
+    const __m512i init = mix[0];
+
+    for (uint32_t i = 0; i < c_accesses; i++)
+    {
+        _mm512_store_si512(lane, A5_FNV(_mm512_xor_si512(_mm512_set1_epi32(i), init), mix[i % c_mixWords]));
+        for (unsigned l = 0; l < 16; l++)
+            lane[l] = lane[l] % numItems;
+
+        if (gather)
+        {
+            for (unsigned l = 0; l < 16; l++)
+                lane[l] *= c_mixWords;
+            const __m512i off = _mm512_load_si512(lane);
+            for (unsigned w = 0; w < c_mixWords; w++)
+                mix[w] = A5_FNV(mix[w], _mm512_i32gather_epi32(off, words + w, 4));
+        }
+        else
+        {
+            alignas(64) uint32_t item[16];
+            for (unsigned w = 0; w < c_mixWords; w++)
+            {
+                for (unsigned l = 0; l < 16; l++)
+                    item[l] = dag[lane[l]].word32s[w];
+                mix[w] = A5_FNV(mix[w], _mm512_load_si512(item));
+            }
+        }
+    }
+
+    for (unsigned k = 0; k < 8; k++)
+    {
+        _mm512_store_si512(lane, A5_FNV(A5_FNV(A5_FNV(mix[4 * k], mix[4 * k + 1]),
+                                               mix[4 * k + 2]), mix[4 * k + 3]));
+        for (unsigned l = 0; l < 16; l++)
+            cmix[l].word32s[k] = lane[l];
+    }
+}
+
+#endif // HASHIMOTO_X86
+
+// HostHashimoto
+
+HostHashimoto::HostHashimoto(unsigned lanes)
+{
+    // AVX-512 runs 16 nonces, AVX2 8, anything else 4 interleaved
+    const unsigned widest = keccak_lanes() >= 8 ? 16 : keccak_lanes() >= 4 ? 8 : 4;
+    m_lanes = (lanes == 4 || lanes == 8 || lanes == 16) ? std::min(lanes, widest) : widest;
+}
+
+const char *HostHashimoto::isa() const
+{
+    return m_lanes >= 16 ? "AVX-512" : m_lanes >= 8 ? "AVX2" : "scalar";
+}
+
+// seed = keccak512(header . nonce)
+static void hash_seeds(const ethash::hash256 &header, const uint64_t nonce[], ethash_hash512 seed[], unsigned lanes)
+{
+    uint64_t msg[c_hashimotoMaxLanes][5];
+    const uint64_t *in[c_hashimotoMaxLanes];
+    uint64_t *out[c_hashimotoMaxLanes];
+
+    for (unsigned l = 0; l < lanes; l++)
+    {
+        memcpy(msg[l], header.bytes, sizeof(header.bytes));
+        msg[l][4] = nonce[l];
+        in[l] = msg[l];
+        out[l] = seed[l].word64s;
+    }
+    keccak_runs(in, 5, out, 8, 9, lanes);
+}
+
+// final = keccak256(seed . mix)
+static void hash_finals(const ethash_hash512 seed[], const ethash::hash256 mix[], ethash::hash256 final[],
+                        unsigned lanes)
+{
+    uint64_t msg[c_hashimotoMaxLanes][12];
+    const uint64_t *in[c_hashimotoMaxLanes];
+    uint64_t *out[c_hashimotoMaxLanes];
+
+    for (unsigned l = 0; l < lanes; l++)
+    {
+        memcpy(msg[l], seed[l].word64s, sizeof(seed[l].word64s));
+        memcpy(msg[l] + 8, mix[l].bytes, sizeof(mix[l].bytes));
+        in[l] = msg[l];
+        out[l] = final[l].word64s;
+    }
+    keccak_runs(in, 12, out, 4, 17, lanes);
+}
+
+// hash(lanes nonces) until count are done, the hits of the 64-bit target
+template <class Hash>
+static uint64_t search_lanes(Hash hash, unsigned lanes, uint64_t target, uint64_t start, uint64_t count,
+                             std::vector<ethash::search_result> &sols, const std::atomic<bool> *abort)
+{
+    uint64_t nonce[c_hashimotoMaxLanes];
+    ethash::hash256 final[c_hashimotoMaxLanes];
+    ethash::hash256 mix[c_hashimotoMaxLanes];
+    uint64_t done = 0;
+
+    while (done < count)
+    {
+        // abort() lands within a few thousand hashes
+        if ((done & 4095) == 0 && abort && *abort)
+            break;
+
+        const unsigned valid = (unsigned)std::min<uint64_t>(lanes, count - done);
+        for (unsigned l = 0; l < lanes; l++)
+            nonce[l] = start + done + std::min(l, valid - 1); // pad the tail
+
+        hash(nonce, final, mix);
+
+        for (unsigned l = 0; l < valid; l++)
+        {
+            // the leading 64 bits big-endian, as the kernel compares them
+            if (get_target_value(final[l]) > target)
+                continue;
+            ethash::search_result r;
+            r.solution_found = true;
+            r.nonce = nonce[l];
+            r.final_hash = final[l];
+            r.mix_hash = mix[l];
+            sols.push_back(r);
+        }
+        done += valid;
+    }
+    return done;
+}
+
+void HostHashimoto::hash(const ethash_hash1024 *dag, uint32_t numItems, const ethash::hash256 &header,
+                         const uint64_t nonce[], ethash::hash256 final[], ethash::hash256 mix[]) const
+{
+    const unsigned lanes = m_lanes;
+    ethash_hash512 seed[c_hashimotoMaxLanes];
+
+    hash_seeds(header, nonce, seed, lanes);
+
+#ifdef HASHIMOTO_X86
+    if (lanes == 16)
+        mix_avx512(dag, numItems, seed, mix);
+    else if (lanes == 8)
+        mix_avx2(dag, numItems, seed, mix);
+    else
+#endif
+        mix_x1(dag, numItems, seed, mix, lanes);
+
+    hash_finals(seed, mix, final, lanes);
+}
+
+void HostHashimoto::hash_light(const ethash::epoch_context &ctx, const ethash_hash1024 *items, uint32_t cachedItems,
+                               const ethash::hash256 &header, const uint64_t nonce[], ethash::hash256 final[],
+                               ethash::hash256 mix[]) const
+{
+    ethash_hash512 seed[c_hashimotoMaxLanes];
+
+    hash_seeds(header, nonce, seed, m_lanes);
+    mix_light(ctx, items, cachedItems, seed, mix, m_lanes);
+    hash_finals(seed, mix, final, m_lanes);
+}
+
+uint64_t HostHashimoto::search(const ethash_hash1024 *dag, uint32_t numItems, const ethash::hash256 &header,
+                               uint64_t target, uint64_t start, uint64_t count,
+                               std::vector<ethash::search_result> &sols, const std::atomic<bool> *abort) const
+{
+    auto hash = [&](const uint64_t nonce[], ethash::hash256 final[], ethash::hash256 mix[]) {
+        this->hash(dag, numItems, header, nonce, final, mix);
+    };
+    return search_lanes(hash, m_lanes, target, start, count, sols, abort);
+}
+
+uint64_t HostHashimoto::search_light(const ethash::epoch_context &ctx, const ethash_hash1024 *items,
+                                     uint32_t cachedItems, const ethash::hash256 &header, uint64_t target,
+                                     uint64_t start, uint64_t count, std::vector<ethash::search_result> &sols,
+                                     const std::atomic<bool> *abort) const
+{
+    auto hash = [&](const uint64_t nonce[], ethash::hash256 final[], ethash::hash256 mix[]) {
+        hash_light(ctx, items, cachedItems, header, nonce, final, mix);
+    };
+    return search_lanes(hash, m_lanes, target, start, count, sols, abort);
+}
+
+size_t HostHashimoto::cross_check(const ethash_hash1024 *dag, uint32_t numItems, const ethash::hash256 &header,
+                                  const ethash::hash256 &boundary, std::vector<ethash::search_result> &sols) const
+{
+    const unsigned lanes = m_lanes;
+    uint64_t nonce[c_hashimotoMaxLanes];
+    ethash::hash256 final[c_hashimotoMaxLanes];
+    ethash::hash256 mix[c_hashimotoMaxLanes];
+    std::vector<bool> bad(sols.size(), false);
+
+    for (size_t first = 0; first < sols.size(); first += lanes)
+    {
+        const unsigned valid = (unsigned)std::min<size_t>(lanes, sols.size() - first);
+        for (unsigned l = 0; l < lanes; l++)
+            nonce[l] = sols[first + std::min(l, valid - 1)].nonce;
+
+        hash(dag, numItems, header, nonce, final, mix);
+
+        for (unsigned l = 0; l < valid; l++)
+        {
+            const ethash::search_result &r = sols[first + l];
+            if (memcmp(mix[l].bytes, r.mix_hash.bytes, sizeof(mix[l].bytes)) == 0 &&
+                ethash::is_less_or_equal(final[l], boundary))
+                continue;
+            printf("Search: nonce %lu rejected by cross-check\n", r.nonce);
+            bad[first + l] = true;
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < sols.size(); i++)
+        if (!bad[i])
+            sols[kept++] = sols[i];
+    const size_t dropped = sols.size() - kept;
+    sols.resize(kept);
+    return dropped;
+}
+
+bool HostHashimoto::check(const ethash::epoch_context_full &ctx, unsigned samples) const
+{
+    const unsigned lanes = m_lanes;
+    uint64_t nonce[c_hashimotoMaxLanes];
+    ethash::hash256 final[c_hashimotoMaxLanes];
+    ethash::hash256 mix[c_hashimotoMaxLanes];
+    ethash::hash256 header = {};
+    header.bytes[0] = 0x5a;
+
+    for (unsigned s = 0; s < samples; s += lanes)
+    {
+        // spread over the nonce space, the DAG items they read are random anyway
+        for (unsigned l = 0; l < lanes; l++)
+            nonce[l] = (s + l) * 0x9e3779b97f4a7c15ULL;
+
+        hash(ctx.full_dataset, ctx.full_dataset_num_items, header, nonce, final, mix);
+
+        for (unsigned l = 0; l < lanes && s + l < samples; l++)
+        {
+            const ethash::result ref = ethash::hash(ctx, header, nonce[l]);
+            if (memcmp(ref.final_hash.bytes, final[l].bytes, sizeof(ref.final_hash.bytes)) != 0 ||
+                memcmp(ref.mix_hash.bytes, mix[l].bytes, sizeof(ref.mix_hash.bytes)) != 0)
+            {
+                printf("CPU: %s hashimoto of nonce %lu differs from ethash !!!\n", isa(), nonce[l]);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool HostHashimoto::check_light(const ethash::epoch_context &ctx, const ethash_hash1024 *items,
+                                uint32_t cachedItems, unsigned samples) const
+{
+    const unsigned lanes = m_lanes;
+    uint64_t nonce[c_hashimotoMaxLanes];
+    ethash::hash256 final[c_hashimotoMaxLanes];
+    ethash::hash256 mix[c_hashimotoMaxLanes];
+    ethash::hash256 header = {};
+    header.bytes[0] = 0x5a;
+
+    for (unsigned s = 0; s < samples; s += lanes)
+    {
+        for (unsigned l = 0; l < lanes; l++)
+            nonce[l] = (s + l) * 0x9e3779b97f4a7c15ULL;
+
+        hash_light(ctx, items, cachedItems, header, nonce, final, mix);
+
+        for (unsigned l = 0; l < lanes && s + l < samples; l++)
+        {
+            const ethash::result ref = ethash::hash(ctx, header, nonce[l]);
+            if (memcmp(ref.final_hash.bytes, final[l].bytes, sizeof(ref.final_hash.bytes)) != 0 ||
+                memcmp(ref.mix_hash.bytes, mix[l].bytes, sizeof(ref.mix_hash.bytes)) != 0)
+            {
+                printf("CPU: light hashimoto of nonce %lu differs from ethash !!!\n", nonce[l]);
+                return false;
+            }
+        }
+    }
+    return true;
+}
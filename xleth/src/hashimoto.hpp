@@ -0,0 +1,59 @@
+#ifndef _HASHIMOTO_H
+#define _HASHIMOTO_H
+
+#include "backend.hpp"
+#include "keccakx.hpp"
+
+//------------------------------------------------------------------------------
+// host hashimoto
+//------------------------------------------------------------------------------
+// Ethash over the full dataset for 4 (scalar), 8 (AVX2) or 16 (AVX-512)
+// nonces per call. The 1024-bit mixes are kept transposed, one 32-bit word of
+// every nonce per vector register, so FNV runs on all nonces at once and the
+// 64 DAG reads of each word are gathers. Keccak runs on keccak_xn() lanes.
+const unsigned c_hashimotoMaxLanes = 16;
+
+class HostHashimoto
+{
+protected:
+    unsigned m_lanes;
+
+public:
+    // lanes 0: the widest the host supports, otherwise 4, 8 or 16
+    explicit HostHashimoto(unsigned lanes = 0);
+
+    unsigned lanes() const { return m_lanes; }
+    const char *isa() const;
+
+    // final and mix hashes of nonce[0..lanes()), dag is the plain ethash layout
+    void hash(const ethash_hash1024 *dag, uint32_t numItems, const ethash::hash256 &header,
+              const uint64_t nonce[], ethash::hash256 final[], ethash::hash256 mix[]) const;
+
+    // Hash [start, start + count) and append the nonces whose final hash
+    // passes the 64-bit target of get_target_value(), as the search kernel
+    // does. Returns the nonces hashed, less than count once abort is set.
+    uint64_t search(const ethash_hash1024 *dag, uint32_t numItems, const ethash::hash256 &header,
+                    uint64_t target, uint64_t start, uint64_t count,
+                    std::vector<ethash::search_result> &sols, const std::atomic<bool> *abort = nullptr) const;
+
+    // Recompute the hits of a device and drop those whose mix differs or
+    // whose final hash is above the boundary, return how many were dropped
+    size_t cross_check(const ethash_hash1024 *dag, uint32_t numItems, const ethash::hash256 &header,
+                       const ethash::hash256 &boundary, std::vector<ethash::search_result> &sols) const;
+
+    // Light variants: items from the first cachedItems of the DAG in items,
+    // the others computed from the light cache of ctx on every access
+    void hash_light(const ethash::epoch_context &ctx, const ethash_hash1024 *items, uint32_t cachedItems,
+                    const ethash::hash256 &header, const uint64_t nonce[], ethash::hash256 final[],
+                    ethash::hash256 mix[]) const;
+    uint64_t search_light(const ethash::epoch_context &ctx, const ethash_hash1024 *items, uint32_t cachedItems,
+                          const ethash::hash256 &header, uint64_t target, uint64_t start, uint64_t count,
+                          std::vector<ethash::search_result> &sols, const std::atomic<bool> *abort = nullptr) const;
+
+    // compare `samples` nonces with the ethash library
+    bool check(const ethash::epoch_context_full &ctx, unsigned samples) const;
+    bool check_light(const ethash::epoch_context &ctx, const ethash_hash1024 *items, uint32_t cachedItems,
+                     unsigned samples) const;
+};
+
+#endif // _HASHIMOTO_H
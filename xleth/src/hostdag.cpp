@@ -0,0 +1,177 @@
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HOSTDAG_X86 1
+#endif
+
+#include <lib/ethash/ethash-internal.hpp>
+
+#include "hostdag.hpp"
+
+static const uint32_t c_dagParents = 256;
+
+// mix[l] = fnv(mix[l], cache[parent]) for 256 parents, lanes interleaved
+static void mix_parents_x1(const ethash_hash512 *cache, uint32_t numCache,
+                           const uint32_t node[], ethash_hash512 mix[], unsigned lanes)
+{
+    for (uint32_t j = 0; j < c_dagParents; j++)
+    {
+        for (unsigned l = 0; l < lanes; l++)
+        {
+            const uint32_t parent = fnv1(node[l] ^ j, mix[l].word32s[j % 16]) % numCache;
+            for (unsigned w = 0; w < 16; w++)
+                mix[l].word32s[w] = fnv1(mix[l].word32s[w], cache[parent].word32s[w]);
+        }
+    }
+}
+
+#ifdef HOSTDAG_X86
+
+__attribute__((target("avx2")))
+static void mix_parents_avx2(const ethash_hash512 *cache, uint32_t numCache,
+                             const uint32_t node[], ethash_hash512 mix[], unsigned lanes)
+{
+    const __m256i prime = _mm256_set1_epi32(FNV_PRIME);
+
+    for (uint32_t j = 0; j < c_dagParents; j++)
+    {
+        for (unsigned l = 0; l < lanes; l++)
+        {
+            const uint32_t parent = fnv1(node[l] ^ j, mix[l].word32s[j % 16]) % numCache;
+            __m256i *m = (__m256i *)mix[l].word32s;
+            const __m256i *p = (const __m256i *)cache[parent].word32s;
+            _mm256_storeu_si256(m, _mm256_xor_si256(
+                _mm256_mullo_epi32(_mm256_loadu_si256(m), prime), _mm256_loadu_si256(p)));
+            _mm256_storeu_si256(m + 1, _mm256_xor_si256(
+                _mm256_mullo_epi32(_mm256_loadu_si256(m + 1), prime), _mm256_loadu_si256(p + 1)));
+        }
+    }
+}
+
+__attribute__((target("avx512f")))
+static void mix_parents_avx512(const ethash_hash512 *cache, uint32_t numCache,
+                               const uint32_t node[], ethash_hash512 mix[], unsigned lanes)
+{
+    const __m512i prime = _mm512_set1_epi32(FNV_PRIME);
+
+    for (uint32_t j = 0; j < c_dagParents; j++)
+    {
+        for (unsigned l = 0; l < lanes; l++)
+        {
+            const uint32_t parent = fnv1(node[l] ^ j, mix[l].word32s[j % 16]) % numCache;
+            _mm512_storeu_si512(mix[l].word32s, _mm512_xor_si512(
+                _mm512_mullo_epi32(_mm512_loadu_si512(mix[l].word32s), prime),
+                _mm512_loadu_si512(cache[parent].word32s)));
+        }
+    }
+}
+
+#endif // HOSTDAG_X86
+
+// 512-bit dataset nodes node[0..lanes), same as calculate_dataset_item_512
+static void calc_nodes(const ethash_hash512 *cache, uint32_t numCache,
+                       const uint32_t node[], ethash_hash512 out[], unsigned lanes)
+{
+    ethash_hash512 mix[c_keccakMaxLanes];
+    const uint64_t *in[c_keccakMaxLanes];
+    uint64_t *res[c_keccakMaxLanes];
+
+    for (unsigned l = 0; l < lanes; l++)
+    {
+        mix[l] = cache[node[l] % numCache];
+        mix[l].word32s[0] ^= node[l];
+        in[l] = mix[l].word64s;
+        res[l] = mix[l].word64s;
+    }
+    keccak_xn(in, 8, res, 8, 9, lanes);
+
+#ifdef HOSTDAG_X86
+    if (lanes >= 8)
+        mix_parents_avx512(cache, numCache, node, mix, lanes);
+    else if (lanes >= 4)
+        mix_parents_avx2(cache, numCache, node, mix, lanes);
+    else
+#endif
+        mix_parents_x1(cache, numCache, node, mix, lanes);
+
+    for (unsigned l = 0; l < lanes; l++)
+        res[l] = out[l].word64s;
+    keccak_xn(in, 8, res, 8, 9, lanes);
+}
+
+// HostDag
+
+HostDag::HostDag(unsigned threads)
+{
+    m_threads = threads ? threads : std::thread::hardware_concurrency();
+    if (m_threads == 0)
+        m_threads = 1;
+    m_lanes = keccak_lanes();
+}
+
+void HostDag::generate(const EpochContext &ec, uint32_t first, uint32_t last,
+                       uint8_t *const parts[], unsigned nparts) const
+{
+    assert(first % nparts == 0);
+
+    const ethash_hash512 *cache = ec.lightCache;
+    const uint32_t numCache = ec.lightNumItems;
+    const unsigned lanes = m_lanes;
+
+    // every thread takes a contiguous run of 512-bit nodes
+    const uint64_t firstNode = 2 * (uint64_t)first;
+    const uint64_t numNodes = 2 * (uint64_t)(last - first);
+    const uint64_t perThread = std::max<uint64_t>(lanes, (numNodes / m_threads + lanes - 1) / lanes * lanes);
+
+    auto worker = [=](uint64_t begin, uint64_t end) {
+        uint32_t node[c_keccakMaxLanes];
+        ethash_hash512 out[c_keccakMaxLanes];
+
+        for (uint64_t n = begin; n < end; n += lanes)
+        {
+            const unsigned valid = (unsigned)std::min<uint64_t>(lanes, end - n);
+            for (unsigned l = 0; l < lanes; l++)
+                node[l] = (uint32_t)(n + std::min(l, valid - 1)); // pad the tail
+
+            calc_nodes(cache, numCache, node, out, lanes);
+
+            for (unsigned l = 0; l < valid; l++)
+            {
+                const uint32_t item = node[l] >> 1;
+                uint8_t *dst = parts[item % nparts] +
+                               (uint64_t)(item / nparts - first / nparts) * 128 +
+                               (node[l] & 1) * 64;
+                memcpy(dst, out[l].bytes, 64);
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (uint64_t begin = firstNode; begin < firstNode + numNodes; begin += perThread)
+        workers.emplace_back(worker, begin, std::min(firstNode + numNodes, begin + perThread));
+    for (auto &w : workers)
+        w.join();
+}
+
+bool HostDag::check(const EpochContext &ec, uint32_t first, uint32_t last,
+                    const uint8_t *const parts[], unsigned nparts, unsigned samples) const
+{
+    const LightHandle light = ec.light ? ec.light : EpochManager::instance().get(ec.epochNumber);
+    const ethash::epoch_context &ctx = light->ctx;
+    const uint32_t count = last - first;
+
+    for (unsigned s = 0; s < samples && count; s++)
+    {
+        // first, last and evenly spread items in between
+        const uint32_t item = first + (samples > 1 ? (uint32_t)((uint64_t)(count - 1) * s / (samples - 1)) : 0);
+        const ethash::hash1024 ref = ethash::calculate_dataset_item_1024(ctx, item);
+        const uint8_t *got = parts[item % nparts] + (uint64_t)(item / nparts - first / nparts) * 128;
+        if (memcmp(ref.bytes, got, sizeof(ref.bytes)) != 0)
+        {
+            printf("DAG: host item %u differs from ethash !!!\n", item);
+            return false;
+        }
+    }
+    return true;
+}
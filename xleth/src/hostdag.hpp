@@ -0,0 +1,39 @@
+#ifndef _HOSTDAG_H
+#define _HOSTDAG_H
+
+#include "backend.hpp"
+#include "keccakx.hpp"
+
+//------------------------------------------------------------------------------
+// host DAG
+//------------------------------------------------------------------------------
+// Generates full dataset items on all host cores. Items of one work group are
+// computed in lockstep so their random light cache reads overlap, Keccak runs
+// over all lanes at once and FNV on a whole 512-bit node per instruction.
+//
+// The output uses the split layout of GenerateDAG generalized to N parts:
+// 1024-bit item i lands in part i % N at index i / N (N = 1 is the plain
+// ethash layout, N = 2 matches _DAG0/_DAG1).
+class HostDag
+{
+protected:
+    unsigned m_threads;
+    unsigned m_lanes;
+
+public:
+    explicit HostDag(unsigned threads = 0);
+
+    unsigned threads() const { return m_threads; }
+    const char *isa() const { return keccak_isa(m_lanes); }
+
+    // Items [first, last), first a multiple of nparts. parts[p] points at
+    // index first / nparts of part p.
+    void generate(const EpochContext &ec, uint32_t first, uint32_t last,
+                  uint8_t *const parts[], unsigned nparts) const;
+
+    // compare `samples` items of a generated range with the ethash library
+    bool check(const EpochContext &ec, uint32_t first, uint32_t last,
+               const uint8_t *const parts[], unsigned nparts, unsigned samples) const;
+};
+
+#endif // _HOSTDAG_H
@@ -0,0 +1,188 @@
+#include <assert.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KECCAKX_X86 1
+#endif
+
+#include "keccakx.hpp"
+
+static const uint64_t c_keccakRC[24] = {
+    0x0000000000000001ULL, 0x0000000000008082ULL, 0x800000000000808aULL,
+    0x8000000080008000ULL, 0x000000000000808bULL, 0x0000000080000001ULL,
+    0x8000000080008081ULL, 0x8000000000008009ULL, 0x000000000000008aULL,
+    0x0000000000000088ULL, 0x0000000080008009ULL, 0x000000008000000aULL,
+    0x000000008000808bULL, 0x800000000000008bULL, 0x8000000000008089ULL,
+    0x8000000000008003ULL, 0x8000000000008002ULL, 0x8000000000000080ULL,
+    0x000000000000800aULL, 0x800000008000000aULL, 0x8000000080008081ULL,
+    0x8000000000008080ULL, 0x0000000080000001ULL, 0x8000000080008008ULL,
+};
+
+static const int c_keccakRotc[24] = {
+    1, 3, 6, 10, 15, 21, 28, 36, 45, 55, 2, 14,
+    27, 41, 56, 8, 25, 43, 62, 18, 39, 61, 20, 44,
+};
+
+static const int c_keccakPiln[24] = {
+    10, 7, 11, 17, 18, 3, 5, 16, 8, 21, 24, 4,
+    15, 23, 19, 13, 12, 2, 20, 14, 22, 9, 6, 1,
+};
+
+// one body for every lane width, V is the register type holding one word
+// of each state, ANDN(a, b) is ~a & b
+#define KECCAKF1600(V, st, XOR, ANDN, ROL, RC)                                  \
+    for (int round = 0; round < 24; round++)                                    \
+    {                                                                           \
+        V bc[5], t;                                                             \
+        for (int i = 0; i < 5; i++)                                             \
+            bc[i] = XOR(XOR(XOR(st[i], st[i + 5]), XOR(st[i + 10], st[i + 15])), \
+                        st[i + 20]);                                            \
+        for (int i = 0; i < 5; i++)                                             \
+        {                                                                       \
+            t = XOR(bc[(i + 4) % 5], ROL(bc[(i + 1) % 5], 1));                  \
+            for (int j = 0; j < 25; j += 5)                                     \
+                st[j + i] = XOR(st[j + i], t);                                  \
+        }                                                                       \
+        t = st[1];                                                              \
+        for (int i = 0; i < 24; i++)                                            \
+        {                                                                       \
+            int j = c_keccakPiln[i];                                            \
+            bc[0] = st[j];                                                      \
+            st[j] = ROL(t, c_keccakRotc[i]);                                    \
+            t = bc[0];                                                          \
+        }                                                                       \
+        for (int j = 0; j < 25; j += 5)                                         \
+        {                                                                       \
+            for (int i = 0; i < 5; i++)                                         \
+                bc[i] = st[j + i];                                              \
+            for (int i = 0; i < 5; i++)                                         \
+                st[j + i] = XOR(st[j + i], ANDN(bc[(i + 1) % 5], bc[(i + 2) % 5])); \
+        }                                                                       \
+        st[0] = XOR(st[0], RC(c_keccakRC[round]));                              \
+    }
+
+#define S_XOR(a, b) ((a) ^ (b))
+#define S_ANDN(a, b) (~(a) & (b))
+#define S_ROL(a, n) (((a) << (n)) | ((a) >> (64 - (n))))
+#define S_RC(c) (c)
+
+static void keccak_x1(const uint64_t *in, unsigned inWords, uint64_t *out,
+                      unsigned outWords, unsigned rateWords)
+{
+    uint64_t st[25] = {0};
+
+    for (unsigned i = 0; i < inWords; i++)
+        st[i] = in[i];
+    st[inWords] ^= 0x01;
+    st[rateWords - 1] ^= 0x8000000000000000ULL;
+
+    KECCAKF1600(uint64_t, st, S_XOR, S_ANDN, S_ROL, S_RC)
+
+    for (unsigned i = 0; i < outWords; i++)
+        out[i] = st[i];
+}
+
+#ifdef KECCAKX_X86
+
+#define A2_XOR(a, b) _mm256_xor_si256((a), (b))
+#define A2_ANDN(a, b) _mm256_andnot_si256((a), (b))
+#define A2_ROL(a, n) _mm256_or_si256(_mm256_sllv_epi64((a), _mm256_set1_epi64x(n)), \
+                                     _mm256_srlv_epi64((a), _mm256_set1_epi64x(64 - (n))))
+#define A2_RC(c) _mm256_set1_epi64x((long long)(c))
+
+__attribute__((target("avx2")))
+static void keccak_x4(const uint64_t *const in[], unsigned inWords,
+                      uint64_t *const out[], unsigned outWords, unsigned rateWords)
+{
+    __m256i st[25];
+    alignas(32) uint64_t w[4];
+
+    for (unsigned i = 0; i < 25; i++)
+    {
+        if (i < inWords)
+            st[i] = _mm256_set_epi64x(in[3][i], in[2][i], in[1][i], in[0][i]);
+        else
+            st[i] = _mm256_setzero_si256();
+    }
+    st[inWords] = _mm256_xor_si256(st[inWords], _mm256_set1_epi64x(0x01));
+    st[rateWords - 1] = _mm256_xor_si256(st[rateWords - 1],
+                                         _mm256_set1_epi64x((long long)0x8000000000000000ULL));
+
+    KECCAKF1600(__m256i, st, A2_XOR, A2_ANDN, A2_ROL, A2_RC)
+
+    for (unsigned i = 0; i < outWords; i++)
+    {
+        _mm256_store_si256((__m256i *)w, st[i]);
+        for (unsigned l = 0; l < 4; l++)
+            out[l][i] = w[l];
+    }
+}
+
+#define A5_XOR(a, b) _mm512_xor_si512((a), (b))
+#define A5_ANDN(a, b) _mm512_andnot_si512((a), (b))
+#define A5_ROL(a, n) _mm512_rolv_epi64((a), _mm512_set1_epi64(n))
+#define A5_RC(c) _mm512_set1_epi64((long long)(c))
+
+__attribute__((target("avx512f")))
+static void keccak_x8(const uint64_t *const in[], unsigned inWords,
+                      uint64_t *const out[], unsigned outWords, unsigned rateWords)
+{
+    __m512i st[25];
+    alignas(64) uint64_t w[8];
+
+    for (unsigned i = 0; i < 25; i++)
+    {
+        if (i < inWords)
+            st[i] = _mm512_set_epi64(in[7][i], in[6][i], in[5][i], in[4][i],
+                                     in[3][i], in[2][i], in[1][i], in[0][i]);
+        else
+            st[i] = _mm512_setzero_si512();
+    }
+    st[inWords] = _mm512_xor_si512(st[inWords], _mm512_set1_epi64(0x01));
+    st[rateWords - 1] = _mm512_xor_si512(st[rateWords - 1],
+                                         _mm512_set1_epi64((long long)0x8000000000000000ULL));
+
+    KECCAKF1600(__m512i, st, A5_XOR, A5_ANDN, A5_ROL, A5_RC)
+
+    for (unsigned i = 0; i < outWords; i++)
+    {
+        _mm512_store_si512((__m512i *)w, st[i]);
+        for (unsigned l = 0; l < 8; l++)
+            out[l][i] = w[l];
+    }
+}
+
+#endif // KECCAKX_X86
+
+unsigned keccak_lanes()
+{
+#ifdef KECCAKX_X86
+    static const unsigned lanes =
+        __builtin_cpu_supports("avx512f") ? 8 : __builtin_cpu_supports("avx2") ? 4 : 1;
+    return lanes;
+#else
+    return 1;
+#endif
+}
+
+const char *keccak_isa(unsigned lanes)
+{
+    return lanes >= 8 ? "AVX-512" : lanes >= 4 ? "AVX2" : "scalar";
+}
+
+void keccak_xn(const uint64_t *const in[], unsigned inWords,
+               uint64_t *const out[], unsigned outWords,
+               unsigned rateWords, unsigned lanes)
+{
+    assert(inWords < rateWords && rateWords <= 25 && outWords <= 25);
+
+#ifdef KECCAKX_X86
+    if (lanes == 8 && keccak_lanes() >= 8)
+        return keccak_x8(in, inWords, out, outWords, rateWords);
+    if (lanes == 4 && keccak_lanes() >= 4)
+        return keccak_x4(in, inWords, out, outWords, rateWords);
+#endif
+    for (unsigned l = 0; l < lanes; l++)
+        keccak_x1(in[l], inWords, out[l], outWords, rateWords);
+}
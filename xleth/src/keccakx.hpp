@@ -0,0 +1,32 @@
+#ifndef _KECCAKX_H
+#define _KECCAKX_H
+
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// multi-lane Keccak
+//------------------------------------------------------------------------------
+// Keccak-f[1600] over 1 (scalar), 4 (AVX2) or 8 (AVX-512) independent states,
+// one 64-bit state word of every message per vector register. The widest
+// variant the host supports is picked at run time.
+#define FNV_PRIME 0x01000193U
+
+const unsigned c_keccakMaxLanes = 8;
+
+// lanes of the widest Keccak the host can run: 1, 4 or 8
+unsigned keccak_lanes();
+const char *keccak_isa(unsigned lanes);
+
+// Single block Keccak (original 0x01 padding) of `lanes` messages of
+// inWords 64-bit words, rate of rateWords words (9: keccak512, 17: keccak256).
+// Writes the first outWords words of every state, in and out may alias.
+void keccak_xn(const uint64_t *const in[], unsigned inWords,
+               uint64_t *const out[], unsigned outWords,
+               unsigned rateWords, unsigned lanes);
+
+inline uint32_t fnv1(uint32_t u, uint32_t v)
+{
+    return (u * FNV_PRIME) ^ v;
+}
+
+#endif // _KECCAKX_H
@@ -0,0 +1,302 @@
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "metrics.hpp"
+
+// Histogram
+
+void Histogram::record(uint64_t ns) noexcept
+{
+    // bucket b holds [2^(b-1), 2^b)
+    unsigned b = ns ? 64 - __builtin_clzll(ns) : 0;
+    if (b >= c_buckets)
+        b = c_buckets - 1;
+
+    m_bucket[b].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(ns, std::memory_order_relaxed);
+
+    uint64_t prev = m_max.load(std::memory_order_relaxed);
+    while (ns > prev && !m_max.compare_exchange_weak(prev, ns, std::memory_order_relaxed))
+        ;
+}
+
+void Histogram::reset() noexcept
+{
+    for (unsigned b = 0; b < c_buckets; b++)
+        m_bucket[b].store(0, std::memory_order_relaxed);
+    m_count.store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+double Histogram::mean() const noexcept
+{
+    const uint64_t n = count();
+    return n ? double(m_sum.load(std::memory_order_relaxed)) / n : 0.0;
+}
+
+uint64_t Histogram::percentile(double p) const noexcept
+{
+    const uint64_t n = count();
+    if (!n)
+        return 0;
+
+    const uint64_t rank = std::max<uint64_t>(1, (uint64_t)ceil(p * n));
+    uint64_t seen = 0;
+    for (unsigned b = 0; b < c_buckets; b++)
+    {
+        seen += m_bucket[b].load(std::memory_order_relaxed);
+        if (seen >= rank)
+            return std::min(uint64_t(1) << b, max());
+    }
+    return max();
+}
+
+static HistogramStats histogram_stats(const Histogram &h)
+{
+    HistogramStats s;
+    s.count = h.count();
+    s.meanUs = h.mean() / 1000;
+    s.p50Us = h.percentile(0.50) / 1000.0;
+    s.p99Us = h.percentile(0.99) / 1000.0;
+    s.maxUs = h.max() / 1000.0;
+    return s;
+}
+
+// Metrics
+
+Metrics::Metrics(double ewmaTau) : m_ewmaTau(ewmaTau)
+{
+    reset();
+}
+
+int64_t Metrics::now_ns() noexcept
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now().time_since_epoch()).count();
+}
+
+void Metrics::reset() noexcept
+{
+    const int64_t now = now_ns();
+
+    m_hashes.store(0, std::memory_order_relaxed);
+    m_batches.store(0, std::memory_order_relaxed);
+    m_solutions.store(0, std::memory_order_relaxed);
+    m_pending.store(0, std::memory_order_relaxed);
+    m_rate.store(0, std::memory_order_relaxed);
+    m_start.store(now, std::memory_order_relaxed);
+    m_last.store(now, std::memory_order_relaxed);
+    m_jobTime.store(0, std::memory_order_relaxed);
+    kernel.reset();
+    queued.reset();
+    transfer.reset();
+    jobSwitch.reset();
+}
+
+void Metrics::resume() noexcept
+{
+    m_pending.store(0, std::memory_order_relaxed);
+    m_last.store(now_ns(), std::memory_order_relaxed);
+}
+
+void Metrics::job_started() noexcept
+{
+    const int64_t t = m_jobTime.exchange(0, std::memory_order_relaxed);
+    if (t)
+        jobSwitch.record(now_ns() - t);
+}
+
+void Metrics::add_hashes(uint64_t hashes) noexcept
+{
+    m_hashes.fetch_add(hashes, std::memory_order_relaxed);
+    m_batches.fetch_add(1, std::memory_order_relaxed);
+    m_pending.fetch_add(hashes, std::memory_order_relaxed);
+
+    // fold sub-millisecond batches into the next sample, the rate of a
+    // single short interval is mostly timer noise
+    const int64_t now = now_ns();
+    int64_t last = m_last.load(std::memory_order_relaxed);
+    const int64_t dt = now - last;
+    if (dt < 1000000)
+        return;
+
+    // one writer wins the interval, the others leave their hashes pending
+    if (!m_last.compare_exchange_strong(last, now, std::memory_order_relaxed))
+        return;
+
+    const double sample = double(m_pending.exchange(0, std::memory_order_relaxed)) / (dt / 1000.0);
+    const double alpha = 1.0 - exp(-(dt / 1e9) / m_ewmaTau);
+
+    uint64_t prevBits = m_rate.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        double rate;
+        memcpy(&rate, &prevBits, sizeof(rate));
+        // start from the first sample instead of ramping up from zero
+        rate = prevBits ? rate + alpha * (sample - rate) : sample;
+
+        uint64_t bits;
+        memcpy(&bits, &rate, sizeof(bits));
+        if (m_rate.compare_exchange_weak(prevBits, bits, std::memory_order_relaxed))
+            break;
+    }
+}
+
+double Metrics::hashrate() const noexcept
+{
+    const uint64_t bits = m_rate.load(std::memory_order_relaxed);
+    double rate;
+    memcpy(&rate, &bits, sizeof(rate));
+
+    // decay while no batch completes, a stalled device drops to zero
+    const double idle = (now_ns() - m_last.load(std::memory_order_relaxed)) / 1e9;
+    if (idle > 1.0)
+        rate *= exp(-(idle - 1.0) / m_ewmaTau);
+    return rate;
+}
+
+MetricsSnapshot Metrics::snapshot() const noexcept
+{
+    MetricsSnapshot s;
+
+    s.uptime = (now_ns() - m_start.load(std::memory_order_relaxed)) / 1e9;
+    s.hashes = m_hashes.load(std::memory_order_relaxed);
+    s.batches = m_batches.load(std::memory_order_relaxed);
+    s.solutions = m_solutions.load(std::memory_order_relaxed);
+    s.hashRate = hashrate();
+    s.avgRate = s.uptime > 0 ? s.hashes / (s.uptime * 1e6) : 0.0;
+    s.kernel = histogram_stats(kernel);
+    s.queued = histogram_stats(queued);
+    s.transfer = histogram_stats(transfer);
+    s.jobSwitch = histogram_stats(jobSwitch);
+
+    return s;
+}
+
+std::string Metrics::to_text(const char *name, const MetricsSnapshot &s)
+{
+    char buf[1024];
+    int n = 0;
+
+    n += snprintf(buf + n, sizeof(buf) - n,
+                  "MET: %-12s %8.2f Mh (avg %8.2f) hashes %lu batches %lu sols %lu uptime %.1fs\n",
+                  name, s.hashRate, s.avgRate, s.hashes, s.batches, s.solutions, s.uptime);
+
+    const struct { const char *name; const HistogramStats &h; } hists[] = {
+        {"kernel", s.kernel}, {"queued", s.queued}, {"transfer", s.transfer}, {"switch", s.jobSwitch}};
+    for (auto &h : hists)
+    {
+        n += snprintf(buf + n, sizeof(buf) - n,
+                      "MET: %-12s %-8s n %8lu mean %10.1fus p50 %10.1fus p99 %10.1fus max %10.1fus\n",
+                      name, h.name, h.h.count, h.h.meanUs, h.h.p50Us, h.h.p99Us, h.h.maxUs);
+    }
+
+    return std::string(buf, std::min<size_t>(n, sizeof(buf) - 1));
+}
+
+std::string Metrics::to_json(const char *name, const MetricsSnapshot &s)
+{
+    char buf[1024];
+    int n = 0;
+
+    n += snprintf(buf + n, sizeof(buf) - n,
+                  "{\"device\":\"%s\",\"uptime\":%.3f,\"hashes\":%lu,\"batches\":%lu,\"solutions\":%lu,"
+                  "\"hashrate_mh\":%.3f,\"avg_hashrate_mh\":%.3f",
+                  name, s.uptime, s.hashes, s.batches, s.solutions, s.hashRate, s.avgRate);
+
+    const struct { const char *name; const HistogramStats &h; } hists[] = {
+        {"kernel", s.kernel}, {"queued", s.queued}, {"transfer", s.transfer}, {"switch", s.jobSwitch}};
+    for (auto &h : hists)
+    {
+        n += snprintf(buf + n, sizeof(buf) - n,
+                      ",\"%s_us\":{\"count\":%lu,\"mean\":%.1f,\"p50\":%.1f,\"p99\":%.1f,\"max\":%.1f}",
+                      h.name, h.h.count, h.h.meanUs, h.h.p50Us, h.h.p99Us, h.h.maxUs);
+    }
+    n += snprintf(buf + n, sizeof(buf) - n, "}");
+
+    return std::string(buf, std::min<size_t>(n, sizeof(buf) - 1));
+}
+
+// MetricsDumper
+
+void MetricsDumper::start(unsigned interval, bool text, const std::string &jsonPath)
+{
+    stop();
+
+    m_interval = std::max(1u, interval);
+    m_text = text;
+    m_jsonPath = jsonPath;
+    m_stop = false;
+    m_thread = std::thread(&MetricsDumper::loop, this);
+}
+
+void MetricsDumper::stop()
+{
+    if (!m_thread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    m_thread.join();
+}
+
+void MetricsDumper::loop()
+{
+    std::unique_lock<std::mutex> guard(m_lock);
+    while (!m_cv.wait_for(guard, std::chrono::seconds(m_interval), [this] { return m_stop; }))
+    {
+        guard.unlock();
+        dump();
+        guard.lock();
+    }
+}
+
+void MetricsDumper::dump()
+{
+    std::vector<MetricsSnapshot> snaps;
+    for (auto &src : m_sources)
+        snaps.push_back(src.second->snapshot());
+
+    if (m_text)
+    {
+        std::string out;
+        for (size_t i = 0; i < m_sources.size(); i++)
+            out += Metrics::to_text(m_sources[i].first.c_str(), snaps[i]);
+        fputs(out.c_str(), stdout);
+        fflush(stdout);
+    }
+
+    if (!m_jsonPath.empty())
+    {
+        // write beside the target and rename, readers never see half a file
+        const std::string tmp = m_jsonPath + ".tmp";
+        FILE *fp = fopen(tmp.c_str(), "w");
+        if (!fp)
+        {
+            printf("MET: cannot write %s\n", tmp.c_str());
+            return;
+        }
+
+        fputs("{\"devices\":[", fp);
+        for (size_t i = 0; i < m_sources.size(); i++)
+        {
+            if (i)
+                fputs(",", fp);
+            fputs(Metrics::to_json(m_sources[i].first.c_str(), snaps[i]).c_str(), fp);
+        }
+        fputs("]}\n", fp);
+
+        bool ok = (fclose(fp) == 0);
+        if (!ok || rename(tmp.c_str(), m_jsonPath.c_str()) != 0)
+        {
+            printf("MET: cannot write %s\n", m_jsonPath.c_str());
+            remove(tmp.c_str());
+        }
+    }
+}
@@ -0,0 +1,147 @@
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//------------------------------------------------------------------------------
+// metrics
+//------------------------------------------------------------------------------
+// Counters and timing histograms of one device. Writers (the search loop)
+// only touch atomics, readers take a snapshot at any time from any thread.
+
+// latency histogram over power of two buckets of nanoseconds
+class Histogram
+{
+public:
+    static const unsigned c_buckets = 40; // last bucket holds >= 2^39 ns (~9 min)
+
+private:
+    std::atomic<uint64_t> m_bucket[c_buckets];
+    std::atomic<uint64_t> m_count{0};
+    std::atomic<uint64_t> m_sum{0};
+    std::atomic<uint64_t> m_max{0};
+
+public:
+    Histogram() { reset(); }
+
+    void record(uint64_t ns) noexcept;
+    void reset() noexcept;
+
+    uint64_t count() const noexcept { return m_count.load(std::memory_order_relaxed); }
+    uint64_t max() const noexcept { return m_max.load(std::memory_order_relaxed); }
+    double mean() const noexcept;
+    // upper bound of the bucket holding the p-th percentile, p in [0, 1]
+    uint64_t percentile(double p) const noexcept;
+};
+
+struct HistogramStats
+{
+    uint64_t count;
+    double meanUs;
+    double p50Us;
+    double p99Us;
+    double maxUs;
+};
+
+struct MetricsSnapshot
+{
+    double uptime;     // seconds since reset
+    uint64_t hashes;
+    uint64_t batches;
+    uint64_t solutions;
+    double hashRate;   // EWMA, Mh/s
+    double avgRate;    // hashes / uptime, Mh/s
+    HistogramStats kernel;   // CL_PROFILING_COMMAND_START -> END of the search kernel
+    HistogramStats queued;   // CL_PROFILING_COMMAND_QUEUED -> START of the search kernel
+    HistogramStats transfer; // START -> END of the result buffer writes and reads
+    HistogramStats jobSwitch; // new job -> first launch on it
+};
+
+class Metrics
+{
+    typedef std::chrono::steady_clock clock;
+
+    // the hash rate decays with this time constant
+    const double m_ewmaTau;
+
+    std::atomic<uint64_t> m_hashes{0};
+    std::atomic<uint64_t> m_batches{0};
+    std::atomic<uint64_t> m_solutions{0};
+
+    // EWMA state, the rate is kept as the bit pattern of a double
+    std::atomic<int64_t> m_start{0};
+    std::atomic<int64_t> m_last{0};
+    std::atomic<uint64_t> m_pending{0};
+    std::atomic<uint64_t> m_rate{0};
+    // when the pending job was set, 0 once a launch picked it up
+    std::atomic<int64_t> m_jobTime{0};
+
+    static int64_t now_ns() noexcept;
+
+public:
+    Histogram kernel;
+    Histogram queued;
+    Histogram transfer;
+    Histogram jobSwitch;
+
+    explicit Metrics(double ewmaTau = 5.0);
+
+    void reset() noexcept;
+
+    // a search starts after an idle gap, keep it out of the next rate sample
+    void resume() noexcept;
+    // one batch of hashes finished now
+    void add_hashes(uint64_t hashes) noexcept;
+    // a new job was set, the next job_started() records the latency
+    void job_changed() noexcept { m_jobTime.store(now_ns(), std::memory_order_relaxed); }
+    void job_started() noexcept;
+    void add_solutions(uint64_t count) noexcept { m_solutions.fetch_add(count, std::memory_order_relaxed); }
+
+    // hashes per microsecond (Mh/s)
+    double hashrate() const noexcept;
+    uint64_t hashes() const noexcept { return m_hashes.load(std::memory_order_relaxed); }
+
+    MetricsSnapshot snapshot() const noexcept;
+
+    static std::string to_text(const char *name, const MetricsSnapshot &s);
+    static std::string to_json(const char *name, const MetricsSnapshot &s);
+};
+
+// Periodically writes the metrics of several devices, as text to stdout
+// and/or as JSON to a file that is replaced atomically.
+class MetricsDumper
+{
+    std::vector<std::pair<std::string, const Metrics *>> m_sources;
+    std::string m_jsonPath;
+    bool m_text = true;
+    unsigned m_interval = 10;
+
+    std::thread m_thread;
+    std::mutex m_lock;
+    std::condition_variable m_cv;
+    bool m_stop = false;
+
+    void loop();
+
+public:
+    MetricsDumper() {}
+    ~MetricsDumper() { stop(); }
+
+    void add(const std::string &name, const Metrics &metrics) { m_sources.emplace_back(name, &metrics); }
+    // interval in seconds, text on stdout, JSON file if the path is not empty
+    void start(unsigned interval, bool text, const std::string &jsonPath);
+    void stop();
+    // write once now
+    void dump();
+};
+
+#endif // _METRICS_H
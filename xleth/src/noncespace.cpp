@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "noncespace.hpp"
+
+static int64_t now_ms()
+{
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// NonceSpace
+
+bool NonceSpace::set_extranonce(const std::string &hex, uint64_t batchSize)
+{
+    const char *s = hex.c_str();
+    if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
+        s += 2;
+
+    // 48 bits at most, the devices keep 16 bits or more to search
+    const size_t digits = strlen(s);
+    if (digits > 12 || strspn(s, "0123456789abcdefABCDEF") != digits)
+    {
+        printf("NCE: bad extranonce %s\n", hex.c_str());
+        return false;
+    }
+    // a batch running past the space would hash the nonces of other prefixes
+    if (digits && (1ULL << (64 - digits * 4)) < batchSize)
+    {
+        printf("NCE: extranonce %s leaves fewer nonces than a batch of %lu\n", hex.c_str(), batchSize);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_prefixBits = digits * 4;
+    m_prefix = digits ? strtoull(s, nullptr, 16) << (64 - m_prefixBits) : 0;
+    // a job started with another extranonce does not carry over
+    m_haveJob = false;
+    return true;
+}
+
+void NonceSpace::set_checkpoint(const std::string &path, unsigned intervalMs)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_path = path;
+    m_saveMs = intervalMs;
+}
+
+uint64_t NonceSpace::mark() const
+{
+    uint64_t m = m_next;
+    if (!m_open.empty())
+        m = std::min(m, m_open.begin()->first);
+    if (!m_returned.empty())
+        m = std::min(m, m_returned.begin()->first);
+    return m;
+}
+
+void NonceSpace::switch_job(const ethash::hash256 &header, uint64_t startOffset)
+{
+    // leases of the old job still out are ignored when they complete
+    m_open.clear();
+    m_returned.clear();
+    m_header = header;
+    m_haveJob = true;
+    m_job++;
+    m_next = std::min(startOffset, limit());
+
+    // restarted on the header the checkpoint was taken of
+    FILE *fp = m_path.empty() ? nullptr : fopen(m_path.c_str(), "r");
+    if (fp)
+    {
+        char magic[16], hdr[80];
+        uint64_t prefix, offset;
+        unsigned bits;
+        ethash::hash256 h;
+        if (fscanf(fp, "%15s %79s %lx %u %lu", magic, hdr, &prefix, &bits, &offset) == 5 &&
+            strcmp(magic, "XLETHNS1") == 0 && strlen(hdr) == 64 && prefix == m_prefix && bits == m_prefixBits)
+        {
+            h = to_hash256(hdr);
+            if (memcmp(h.bytes, header.bytes, 32) == 0 && offset > m_next && offset <= limit())
+            {
+                printf("NCE: resuming at nonce 0x%016lx\n", m_prefix + offset);
+                m_next = offset;
+            }
+        }
+        fclose(fp);
+    }
+
+    m_savedMark = 0;
+    m_lastSave = 0;
+}
+
+bool NonceSpace::lease(const ethash::hash256 &header, uint64_t size, NonceLease &lease, uint64_t startOffset)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    if (!m_haveJob || memcmp(header.bytes, m_header.bytes, 32) != 0)
+    {
+        // the searched part of the old job is on disk before it is dropped
+        if (m_haveJob && !m_path.empty())
+            save_locked();
+        // a full nonce of the pool keeps its part below the extranonce
+        if (m_prefixBits)
+            startOffset &= limit() - 1;
+        switch_job(header, startOffset);
+    }
+
+    uint64_t offset, count;
+    if (!m_returned.empty())
+    {
+        // the unsearched ends of earlier leases, lowest first
+        auto it = m_returned.begin();
+        offset = it->first;
+        count = std::min(size, it->second);
+        if (count < it->second)
+            m_returned[offset + count] = it->second - count;
+        m_returned.erase(it);
+    }
+    else
+    {
+        if (m_next >= limit())
+            return false;
+        offset = m_next;
+        count = std::min(size, limit() - m_next);
+        m_next += count;
+    }
+
+    m_open[offset] = count;
+    lease.job = m_job;
+    lease.start = m_prefix + offset;
+    lease.count = count;
+    return true;
+}
+
+void NonceSpace::complete(const NonceLease &lease, uint64_t searched)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    // a lease of a replaced job
+    if (lease.job != m_job)
+        return;
+
+    const uint64_t offset = lease.start - m_prefix;
+    auto it = m_open.find(offset);
+    if (it == m_open.end())
+        return;
+    m_open.erase(it);
+
+    // only an unbroken prefix counts, an aborted batch leaves gaps behind it
+    if (searched < lease.count)
+        m_returned[offset + searched] = lease.count - searched;
+
+    if (!m_path.empty() && now_ms() - m_lastSave >= (int64_t)m_saveMs)
+        save_locked();
+}
+
+uint64_t NonceSpace::high_water() const
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    return m_prefix + mark();
+}
+
+bool NonceSpace::save()
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    return save_locked();
+}
+
+bool NonceSpace::save_locked()
+{
+    if (m_path.empty() || !m_haveJob)
+        return false;
+
+    const uint64_t m = mark();
+    m_lastSave = now_ms();
+    if (m == m_savedMark)
+        return true;
+
+    const std::string tmp = m_path + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "w");
+    if (!fp)
+    {
+        printf("NCE: cannot write %s\n", m_path.c_str());
+        return false;
+    }
+
+    fprintf(fp, "XLETHNS1 %s %016lx %u %lu\n", to_hex(m_header).c_str(), m_prefix, m_prefixBits, m);
+
+    if (fclose(fp) != 0 || rename(tmp.c_str(), m_path.c_str()) != 0)
+    {
+        printf("NCE: cannot write %s\n", m_path.c_str());
+        remove(tmp.c_str());
+        return false;
+    }
+    m_savedMark = m;
+    return true;
+}
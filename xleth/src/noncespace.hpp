@@ -0,0 +1,74 @@
+#ifndef _NONCESPACE_H
+#define _NONCESPACE_H
+
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "backend.hpp"
+
+//------------------------------------------------------------------------------
+// nonce space
+//------------------------------------------------------------------------------
+// The 64-bit nonces of one job shared by every device and session of a worker.
+// A pool assigned extranonce fixes the top bits, leases of the rest are handed
+// out in order and never overlap. What a device did not hash of its lease
+// comes back and is leased again first. The high-water mark, below which every
+// nonce is searched, is checkpointed so a restarted worker goes on from there.
+
+struct NonceLease
+{
+    uint64_t job = 0;   // generation of the space the lease belongs to
+    uint64_t start = 0; // full nonce, extranonce included
+    uint64_t count = 0;
+};
+
+class NonceSpace
+{
+protected:
+    mutable std::mutex m_lock;
+
+    uint64_t m_prefix = 0;   // extranonce in the top bits
+    unsigned m_prefixBits = 0;
+
+    uint64_t m_job = 0; // generation, one per header
+    bool m_haveJob = false;
+    ethash::hash256 m_header = {};
+    uint64_t m_next = 0; // first offset never leased
+    std::map<uint64_t, uint64_t> m_open;     // leased offsets -> count
+    std::map<uint64_t, uint64_t> m_returned; // offsets to lease again -> count
+
+    std::string m_path;
+    unsigned m_saveMs = 1000;
+    int64_t m_lastSave = 0;
+    uint64_t m_savedMark = 0;
+
+    uint64_t limit() const { return m_prefixBits ? (1ULL << (64 - m_prefixBits)) : UINT64_MAX; }
+    uint64_t mark() const;
+    void switch_job(const ethash::hash256 &header, uint64_t startOffset);
+    bool save_locked();
+
+public:
+    // Extranonce as the pool sends it, up to 12 hex digits, "" for none. The
+    // nonces left below it have to hold one batch of every device, a scan
+    // hashes whole batches.
+    bool set_extranonce(const std::string &hex, uint64_t batchSize = 1);
+    // checkpoint file, written at most every intervalMs and on job switches
+    void set_checkpoint(const std::string &path, unsigned intervalMs = 1000);
+
+    // The next free nonces of header, size of them or what is left. The first
+    // lease of a new header starts at startOffset, or at the checkpointed mark
+    // when the checkpoint is of the same header and extranonce.
+    bool lease(const ethash::hash256 &header, uint64_t size, NonceLease &lease, uint64_t startOffset = 0);
+    // searched nonces from the start of a lease, all of them and in order,
+    // the rest is leased again
+    void complete(const NonceLease &lease, uint64_t searched);
+
+    // first nonce not known to be searched, extranonce included
+    uint64_t high_water() const;
+    uint64_t prefix() const { return m_prefix; }
+    unsigned prefix_bits() const { return m_prefixBits; }
+    bool save();
+};
+
+#endif // _NONCESPACE_H
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <ethash/keccak.hpp>
+
+#include "progcache.hpp"
+#include "dagcache.hpp"
+
+static const char c_progMagic[8] = {'X', 'L', 'E', 'T', 'H', 'C', 'L', 'B'};
+
+struct ProgramFileHeader
+{
+    char magic[8]; // "XLETHCLB"
+    uint64_t size;
+};
+
+// ProgramCache
+
+std::string ProgramCache::key(const std::string &source, const std::string &options,
+                              const std::string &device, const std::string &driver)
+{
+    // length prefixed, so no two field splits hash the same
+    std::string buf;
+    for (const std::string *s : {&source, &options, &device, &driver})
+    {
+        const uint64_t len = s->size();
+        buf.append((const char *)&len, sizeof(len));
+        buf.append(*s);
+    }
+
+    const ethash::hash256 h = ethash::keccak256((const uint8_t *)buf.data(), buf.size());
+
+    char hex[33];
+    for (int i = 0; i < 16; i++)
+        snprintf(hex + 2 * i, 3, "%02x", h.bytes[i]);
+    return hex;
+}
+
+std::string ProgramCache::path(const std::string &key) const
+{
+    return m_dir + "/" + key + ".clbin";
+}
+
+bool ProgramCache::load(const std::string &key, std::vector<unsigned char> &binary) const
+{
+    if (!enabled())
+        return false;
+
+    FILE *fp = fopen(path(key).c_str(), "rb");
+    if (!fp)
+        return false;
+
+    ProgramFileHeader hdr;
+    bool ok = fread(&hdr, sizeof(hdr), 1, fp) == 1 &&
+              memcmp(hdr.magic, c_progMagic, sizeof(c_progMagic)) == 0 &&
+              hdr.size > 0 && hdr.size < (1ull << 32);
+    if (ok)
+    {
+        binary.resize(hdr.size);
+        ok = fread(binary.data(), 1, hdr.size, fp) == hdr.size;
+    }
+    fclose(fp);
+
+    return ok;
+}
+
+bool ProgramCache::store(const std::string &key, const std::vector<unsigned char> &binary) const
+{
+    if (!enabled() || binary.empty())
+        return false;
+
+    make_dirs(m_dir);
+
+    // unique per process, several devices may build the same key at once
+    const std::string file = path(key);
+    const std::string tmp = file + ".tmp" + std::to_string((unsigned long)getpid());
+
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if (!fp)
+    {
+        printf("KNL: cannot write %s\n", tmp.c_str());
+        return false;
+    }
+
+    ProgramFileHeader hdr;
+    memcpy(hdr.magic, c_progMagic, sizeof(c_progMagic));
+    hdr.size = binary.size();
+
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+              fwrite(binary.data(), 1, binary.size(), fp) == binary.size();
+    ok = (fclose(fp) == 0) && ok;
+    ok = ok && rename(tmp.c_str(), file.c_str()) == 0;
+    if (!ok)
+    {
+        printf("KNL: cannot write %s\n", file.c_str());
+        ::remove(tmp.c_str());
+    }
+    return ok;
+}
+
+void ProgramCache::remove(const std::string &key) const
+{
+    if (enabled())
+        ::remove(path(key).c_str());
+}
@@ -0,0 +1,38 @@
+#ifndef _PROGCACHE_H
+#define _PROGCACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+//------------------------------------------------------------------------------
+// program cache
+//------------------------------------------------------------------------------
+// CL_PROGRAM_BINARIES of kernels built from source, one file per key. The key
+// hashes everything the build depends on: the final source with its
+// definitions, the build options, the device name and the driver version.
+class ProgramCache
+{
+protected:
+    std::string m_dir;
+
+public:
+    ProgramCache() {}
+    explicit ProgramCache(const std::string &dir) : m_dir(dir) {}
+
+    void set_dir(const std::string &dir) { m_dir = dir; }
+    bool enabled() const { return !m_dir.empty(); }
+
+    static std::string key(const std::string &source, const std::string &options,
+                           const std::string &device, const std::string &driver);
+    std::string path(const std::string &key) const;
+
+    // false if missing, truncated or not a cache file
+    bool load(const std::string &key, std::vector<unsigned char> &binary) const;
+    // write beside the target and rename, readers never see half a file
+    bool store(const std::string &key, const std::vector<unsigned char> &binary) const;
+    // drop an entry the driver refused
+    void remove(const std::string &key) const;
+};
+
+#endif // _PROGCACHE_H
@@ -0,0 +1,134 @@
+#ifndef _QUEUE_H
+#define _QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+//------------------------------------------------------------------------------
+// ring queues
+//------------------------------------------------------------------------------
+// Bounded lock-free rings between the work source thread and the device
+// threads. Neither side ever waits: try_push fails on a full ring and
+// try_pop on an empty one, the caller decides to retry, drop or count.
+// Capacities are rounded up to a power of two.
+
+inline size_t ring_capacity(size_t n)
+{
+    size_t c = 2;
+    while (c < n)
+        c <<= 1;
+    return c;
+}
+
+// one producer, one consumer
+template <typename T>
+class SpscQueue
+{
+protected:
+    std::vector<T> m_slots;
+    const size_t m_mask;
+    // on their own cache lines, producer and consumer do not share one
+    alignas(64) std::atomic<size_t> m_head{0}; // next slot to pop
+    alignas(64) std::atomic<size_t> m_tail{0}; // next slot to push
+
+public:
+    explicit SpscQueue(size_t capacity) : m_slots(ring_capacity(capacity)), m_mask(m_slots.size() - 1) {}
+
+    bool try_push(const T &v)
+    {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == m_slots.size())
+            return false;
+        m_slots[tail & m_mask] = v;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T &v)
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+            return false;
+        v = m_slots[head & m_mask];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const { return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire); }
+    size_t capacity() const { return m_slots.size(); }
+};
+
+// Any number of producers, one consumer. Every cell carries a sequence number
+// telling whose turn it is, a producer claims a cell by advancing the tail
+// and publishes it by bumping the sequence (D. Vyukov's bounded queue).
+template <typename T>
+class MpscQueue
+{
+protected:
+    struct Cell
+    {
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+    std::unique_ptr<Cell[]> m_cells;
+    const size_t m_size;
+    const size_t m_mask;
+    alignas(64) std::atomic<size_t> m_head{0}; // consumer only
+    alignas(64) std::atomic<size_t> m_tail{0};
+
+public:
+    explicit MpscQueue(size_t capacity)
+        : m_cells(new Cell[ring_capacity(capacity)]), m_size(ring_capacity(capacity)), m_mask(m_size - 1)
+    {
+        for (size_t i = 0; i < m_size; i++)
+            m_cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    bool try_push(const T &v)
+    {
+        size_t pos = m_tail.load(std::memory_order_relaxed);
+        Cell *cell;
+        for (;;)
+        {
+            cell = &m_cells[pos & m_mask];
+            const size_t seq = cell->seq.load(std::memory_order_acquire);
+            const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+                return false; // full, the consumer has not freed this cell yet
+            else
+                pos = m_tail.load(std::memory_order_relaxed);
+        }
+        cell->data = v;
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T &v)
+    {
+        const size_t pos = m_head.load(std::memory_order_relaxed);
+        Cell &cell = m_cells[pos & m_mask];
+        if (cell.seq.load(std::memory_order_acquire) != pos + 1)
+            return false;
+        v = cell.data;
+        // free for the push one lap later
+        cell.seq.store(pos + m_size, std::memory_order_release);
+        m_head.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // approximate while producers run
+    size_t size() const { return m_tail.load(std::memory_order_relaxed) - m_head.load(std::memory_order_relaxed); }
+    size_t capacity() const { return m_size; }
+};
+
+#endif // _QUEUE_H
@@ -0,0 +1,204 @@
+#include "scheduler.hpp"
+
+// Scheduler
+
+Scheduler::Scheduler(const std::vector<EthBackend *> &devices, bool debug, unsigned leaseBatches)
+{
+    m_devices = devices;
+    m_debug = debug;
+    m_leaseBatches = std::max(1u, leaseBatches);
+    for (auto d : devices)
+        m_grain = std::max(m_grain, d->batch_size());
+
+    for (size_t i = 0; i < devices.size(); i++)
+    {
+        m_ranges.emplace_back(new NonceRange());
+        m_stats.emplace_back(new DeviceStats());
+    }
+}
+
+bool Scheduler::lease(unsigned dev, uint64_t &start, uint64_t &count)
+{
+    const uint64_t size = m_devices[dev]->batch_size() * m_leaseBatches;
+
+    for (;;)
+    {
+        {
+            NonceRange &r = *m_ranges[dev];
+            std::lock_guard<std::mutex> guard(r.lock);
+            if (r.next < r.end)
+            {
+                start = r.next;
+                count = std::min(size, r.end - r.next);
+                r.next += count;
+                m_stats[dev]->leases++;
+                return true;
+            }
+        }
+        if (!steal(dev))
+            return false;
+    }
+}
+
+bool Scheduler::steal(unsigned dev)
+{
+    const uint64_t size = m_devices[dev]->batch_size() * m_leaseBatches;
+
+    // the victim with the most nonces left
+    unsigned victim = dev;
+    uint64_t most = 0;
+    for (unsigned i = 0; i < m_ranges.size(); i++)
+    {
+        if (i == dev)
+            continue;
+        std::lock_guard<std::mutex> guard(m_ranges[i]->lock);
+        if (m_ranges[i]->end - m_ranges[i]->next > most)
+        {
+            most = m_ranges[i]->end - m_ranges[i]->next;
+            victim = i;
+        }
+    }
+    if (victim == dev)
+        return false;
+
+    uint64_t begin, end;
+    {
+        NonceRange &v = *m_ranges[victim];
+        std::lock_guard<std::mutex> guard(v.lock);
+        const uint64_t left = v.end - v.next;
+        if (left == 0)
+            return true; // drained meanwhile, look again
+
+        // back half, at least one lease unless less is left, in whole grains
+        // so the rest of the victim's range ends on a batch
+        uint64_t take = std::max(std::min(size, left), left / 2);
+        take = std::min(left, (take + m_grain - 1) / m_grain * m_grain);
+        end = v.end;
+        begin = end - take;
+        v.end = begin;
+    }
+
+    NonceRange &r = *m_ranges[dev];
+    std::lock_guard<std::mutex> guard(r.lock);
+    r.next = begin;
+    r.end = end;
+    m_stats[dev]->steals++;
+
+    if (m_debug)
+        printf("SCH: dev %u stole %lu nonces from dev %u\n", dev, end - begin, victim);
+
+    return true;
+}
+
+void Scheduler::device_loop(unsigned dev, const ethash::hash256 &header, const ethash::hash256 &boundary)
+{
+    EthBackend *d = m_devices[dev];
+    std::vector<ethash::search_result> sols;
+    uint64_t start, count;
+
+    while (!m_stop && lease(dev, start, count))
+    {
+        sols.clear();
+        uint64_t hashes = d->scan(start, count, header, boundary, sols);
+        if (!hashes)
+            break; // device failed
+
+        m_stats[dev]->hashes += hashes;
+        m_elapsedUs = duration_cast<microseconds>(steady_clock::now() - m_start).count();
+
+        // whole batches run past the end of a lease into the range of another
+        // device, those hits are its
+        sols.erase(std::remove_if(sols.begin(), sols.end(), [&](const ethash::search_result &r) {
+                       return r.nonce - start >= count;
+                   }), sols.end());
+        // a kernel fault must not pass as a solution or skew the per device counts
+        m_stats[dev]->rejected += d->verify_solutions(header, boundary, sols);
+
+        if (!sols.empty())
+        {
+            std::lock_guard<std::mutex> guard(m_solLock);
+            m_solutions.insert(m_solutions.end(), sols.begin(), sols.end());
+            m_stats[dev]->solutions += sols.size();
+            if (m_maxSolutions && m_solutions.size() >= m_maxSolutions)
+                m_stop = true;
+        }
+    }
+}
+
+std::vector<ethash::search_result> Scheduler::run(const ethash::hash256 &header, const ethash::hash256 &boundary,
+                                                  uint64_t start_nonce, uint64_t count, size_t maxSolutions)
+{
+    const uint64_t endNonce = (count > UINT64_MAX - start_nonce) ? UINT64_MAX : start_nonce + count;
+
+    // initial split proportional to the batch size of each device
+    uint64_t total = 0;
+    for (auto d : m_devices)
+        total += d->batch_size();
+
+    uint64_t next = start_nonce;
+    for (unsigned i = 0; i < m_devices.size(); i++)
+    {
+        const uint64_t share = (i + 1 == m_devices.size())
+                                   ? endNonce - next
+                                   : (uint64_t)((double)(endNonce - start_nonce) * m_devices[i]->batch_size() / total) /
+                                         m_grain * m_grain;
+        m_ranges[i]->next = next;
+        m_ranges[i]->end = next + share;
+        next += share;
+
+        m_stats[i]->hashes = 0;
+        m_stats[i]->leases = 0;
+        m_stats[i]->steals = 0;
+        m_stats[i]->solutions = 0;
+        m_stats[i]->rejected = 0;
+    }
+
+    m_stop = false;
+    m_maxSolutions = maxSolutions;
+    m_solutions.clear();
+    m_start = steady_clock::now();
+    m_elapsedUs = 0;
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < m_devices.size(); i++)
+        threads.emplace_back(&Scheduler::device_loop, this, i, std::cref(header), std::cref(boundary));
+    for (auto &t : threads)
+        t.join();
+
+    m_elapsedUs = duration_cast<microseconds>(steady_clock::now() - m_start).count();
+
+    std::sort(m_solutions.begin(), m_solutions.end(),
+              [](const ethash::search_result &a, const ethash::search_result &b) { return a.nonce < b.nonce; });
+    // each hit is clipped to its lease, one found twice is still reported once
+    m_solutions.erase(std::unique(m_solutions.begin(), m_solutions.end(),
+                                  [](const ethash::search_result &a, const ethash::search_result &b) {
+                                      return a.nonce == b.nonce;
+                                  }), m_solutions.end());
+    return m_solutions;
+}
+
+float Scheduler::get_hashrate(unsigned dev) const
+{
+    const uint64_t us = m_elapsedUs;
+    return us ? (float)m_stats[dev]->hashes / us : 0.0f;
+}
+
+float Scheduler::get_hashrate() const
+{
+    float total = 0;
+    for (unsigned i = 0; i < m_devices.size(); i++)
+        total += get_hashrate(i);
+    return total;
+}
+
+void Scheduler::report() const
+{
+    for (unsigned i = 0; i < m_devices.size(); i++)
+    {
+        printf("SCH: dev %u %-6s %8.2f Mh, hashes %12lu leases %6lu steals %4lu solutions %lu rejected %lu\n",
+               i, m_devices[i]->name(), get_hashrate(i), m_stats[i]->hashes.load(),
+               m_stats[i]->leases.load(), m_stats[i]->steals.load(), m_stats[i]->solutions.load(),
+               m_stats[i]->rejected.load());
+    }
+    printf("SCH: total      %8.2f Mh\n", get_hashrate());
+}
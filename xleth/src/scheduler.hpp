@@ -0,0 +1,67 @@
+#ifndef _SCHEDULER_H
+#define _SCHEDULER_H
+
+#include <mutex>
+
+#include "backend.hpp"
+
+//------------------------------------------------------------------------------
+// scheduler
+//------------------------------------------------------------------------------
+// Runs one job on several backends at once. Every device owns a disjoint
+// nonce range, takes leases of a few batches from its front and, once it
+// runs dry, steals the back half of the largest range left.
+struct NonceRange
+{
+    std::mutex lock;
+    uint64_t next = 0; // first nonce not leased yet
+    uint64_t end = 0;
+};
+
+struct DeviceStats
+{
+    std::atomic<uint64_t> hashes{0};
+    std::atomic<uint64_t> leases{0};
+    std::atomic<uint64_t> steals{0};
+    std::atomic<uint64_t> solutions{0};
+    std::atomic<uint64_t> rejected{0}; // hits failing verification
+};
+
+class Scheduler
+{
+protected:
+    std::vector<EthBackend *> m_devices;
+    std::vector<std::unique_ptr<NonceRange>> m_ranges;
+    std::vector<std::unique_ptr<DeviceStats>> m_stats;
+    unsigned m_leaseBatches;
+    uint64_t m_grain = 1; // largest batch, ranges are split at its multiples
+    bool m_debug;
+
+    std::atomic<bool> m_stop{false};
+    std::mutex m_solLock;
+    std::vector<ethash::search_result> m_solutions;
+    size_t m_maxSolutions = 1;
+
+    steady_clock::time_point m_start;
+    std::atomic<uint64_t> m_elapsedUs{0};
+
+    bool lease(unsigned dev, uint64_t &start, uint64_t &count);
+    bool steal(unsigned dev);
+    void device_loop(unsigned dev, const ethash::hash256 &header, const ethash::hash256 &boundary);
+
+public:
+    Scheduler(const std::vector<EthBackend *> &devices, bool debug, unsigned leaseBatches = 4);
+
+    // Search [start_nonce, start_nonce + count) on all devices, stop after
+    // maxSolutions hits (0: search the whole range). Hits in nonce order.
+    std::vector<ethash::search_result> run(const ethash::hash256 &header, const ethash::hash256 &boundary,
+                                           uint64_t start_nonce, uint64_t count, size_t maxSolutions = 1);
+    void stop() { m_stop = true; }
+
+    // Mh/s since run() started, per device and in total
+    float get_hashrate(unsigned dev) const;
+    float get_hashrate() const;
+    void report() const;
+};
+
+#endif // _SCHEDULER_H
@@ -0,0 +1,166 @@
+#include "session.hpp"
+
+static int64_t now_ns()
+{
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Session
+
+Session::Session(EthBackend &dev, SolutionHandler onSolution, bool debug, unsigned leaseBatches)
+    : m_dev(dev), m_onSolution(onSolution), m_leaseBatches(std::max(1u, leaseBatches)), m_debug(debug)
+{
+    m_worker = std::thread(&Session::worker, this);
+}
+
+uint64_t Session::set_job(const ethash::hash256 &header, const ethash::hash256 &boundary, int epoch,
+                          uint64_t start_nonce)
+{
+    uint64_t job;
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_header = header;
+        m_boundary = boundary;
+        m_epoch = epoch;
+        m_startNonce = start_nonce;
+        job = ++m_job;
+
+        // timed from here to the first launch on the new header
+        m_dev.get_metrics().job_changed();
+        int64_t idle = 0;
+        m_drainStart.compare_exchange_strong(idle, now_ns());
+        // under the lock, the worker clears it when it picks the job up
+        m_dev.abort();
+    }
+    m_wake.notify_one();
+
+    if (m_debug)
+        printf("SES: job %lu epoch %d start nonce %lu\n", job, epoch, start_nonce);
+    return job;
+}
+
+void Session::stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        if (m_quit)
+            return;
+        m_quit = true;
+        m_dev.abort();
+    }
+    m_wake.notify_one();
+
+    if (m_worker.joinable())
+        m_worker.join();
+    m_dev.clear_abort();
+}
+
+void Session::worker()
+{
+    std::vector<ethash::search_result> sols;
+    uint64_t current = 0;
+
+    for (;;)
+    {
+        ethash::hash256 header, boundary;
+        int epoch;
+        uint64_t nonce;
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            m_wake.wait(lock, [&]() { return m_quit || m_job != current; });
+            if (m_quit)
+                break;
+
+            current = m_job;
+            m_active = current;
+            header = m_header;
+            boundary = m_boundary;
+            epoch = m_epoch;
+            nonce = m_startNonce;
+            m_drainStart = 0;
+            m_dev.clear_abort();
+        }
+
+        // new epoch, the DAG switch counts into the job switch latency
+        if (!m_dev.switch_dag(epoch))
+        {
+            printf("SES: no DAG for epoch %d, job %lu dropped\n", epoch, current);
+            continue;
+        }
+
+        // the light cache of the next epoch is ready before the rollover
+        EpochManager::instance().prebuild(epoch + 1);
+
+        m_dev.get_metrics().resume();
+        const uint64_t lease = m_dev.batch_size() * m_leaseBatches;
+
+        while (m_job == current && !m_quit)
+        {
+            // the nonces of the job are the space's, the same header goes on
+            // where any session of it stopped
+            NonceLease l;
+            l.start = nonce;
+            l.count = lease;
+            if (m_space && !m_space->lease(header, lease, l, nonce))
+            {
+                printf("SES: nonce space of job %lu exhausted\n", current);
+                break;
+            }
+
+            sols.clear();
+            const uint64_t hashes = m_dev.scan(l.start, l.count, header, boundary, sols);
+            m_hashes += hashes;
+            nonce += lease;
+            if (m_space)
+                m_space->complete(l, m_dev.searched());
+
+            // whole batches run past the end of a short lease, into nonces
+            // leased to others or of another extranonce
+            sols.erase(std::remove_if(sols.begin(), sols.end(), [&](const ethash::search_result &r) {
+                           return r.nonce - l.start >= l.count;
+                       }), sols.end());
+
+            // hits of the aborted batches still belong to the old header
+            const bool replaced = m_job != current;
+            if (replaced)
+            {
+                const int64_t t = m_drainStart.exchange(0);
+                if (t)
+                    m_drain.record(now_ns() - t);
+            }
+            else if (!hashes && !m_quit)
+            {
+                printf("SES: device failed, job %lu dropped\n", current);
+                break;
+            }
+
+            if (replaced)
+                m_stale += sols.size();
+            else
+                m_solutions += sols.size();
+
+            if (m_verifier)
+            {
+                m_verifier->submit(current, epoch, header, boundary, std::move(sols));
+                continue;
+            }
+
+            m_rejected += m_dev.verify_solutions(header, boundary, sols);
+            if (m_onSolution)
+                for (auto &sol : sols)
+                    m_onSolution(current, sol);
+        }
+    }
+}
+
+void Session::report() const
+{
+    printf("SES: jobs %lu, hashes %lu, hits %lu, stale %lu, rejected %lu\n",
+           m_job.load(), m_hashes.load(), m_solutions.load(), m_stale.load(), m_rejected.load());
+
+    const Histogram &sw = m_dev.get_metrics().jobSwitch;
+    if (sw.count())
+        printf("SES: job -> first launch %.3f ms mean, %.3f ms p99\n", sw.mean() / 1e6, sw.percentile(0.99) / 1e6);
+    if (m_drain.count())
+        printf("SES: job -> old batches drained %.3f ms mean, %.3f ms max\n", m_drain.mean() / 1e6, m_drain.max() / 1e6);
+}
@@ -0,0 +1,84 @@
+#ifndef _SESSION_H
+#define _SESSION_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+
+#include "backend.hpp"
+#include "noncespace.hpp"
+#include "verifier.hpp"
+
+//------------------------------------------------------------------------------
+// session
+//------------------------------------------------------------------------------
+// Long lived search of one backend. A worker thread keeps scanning the current
+// job, set_job() replaces it at any time: the device aborts the batches in
+// flight and the worker restarts on the new header with the buffers and
+// kernel arguments it already has, so a new block costs about one batch of
+// stale work instead of a full restart.
+
+class Session
+{
+protected:
+    EthBackend &m_dev;
+    SolutionHandler m_onSolution;
+    Verifier *m_verifier = nullptr;
+    NonceSpace *m_space = nullptr;
+    unsigned m_leaseBatches;
+    bool m_debug;
+
+    std::thread m_worker;
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    std::atomic<bool> m_quit{false};
+
+    // the job set last, m_job changes under m_lock only
+    std::atomic<uint64_t> m_job{0};
+    // the job the worker scans, every hit of an older one is handed over
+    std::atomic<uint64_t> m_active{0};
+    ethash::hash256 m_header = {};
+    ethash::hash256 m_boundary = {};
+    int m_epoch = -1;
+    uint64_t m_startNonce = 0;
+
+    std::atomic<uint64_t> m_hashes{0};
+    std::atomic<uint64_t> m_solutions{0}; // device hits of the current job
+    std::atomic<uint64_t> m_stale{0};    // hits of a job replaced meanwhile
+    std::atomic<uint64_t> m_rejected{0}; // hits failing verification on the worker
+    // set_job() -> the scan of the old job returned
+    Histogram m_drain;
+    std::atomic<int64_t> m_drainStart{0};
+
+    void worker();
+
+public:
+    Session(EthBackend &dev, SolutionHandler onSolution, bool debug = false, unsigned leaseBatches = 4);
+    ~Session() { stop(); }
+
+    // Search a new job from start_nonce on, the previous one is aborted.
+    // Returns the job number the hits of it are reported with.
+    uint64_t set_job(const ethash::hash256 &header, const ethash::hash256 &boundary, int epoch,
+                     uint64_t start_nonce = 0);
+    // abort the job and end the worker
+    void stop();
+    // Hand the hits to a verifier pool, which delivers the valid ones instead
+    // of the worker verifying them between scans. Set before the first job.
+    void set_verifier(Verifier *verifier) { m_verifier = verifier; }
+    // Lease the nonces from a space shared with other sessions instead of
+    // counting up from start_nonce. Set before the first job.
+    void set_nonce_space(NonceSpace *space) { m_space = space; }
+
+    uint64_t job() const { return m_job; }
+    // jobs before it have no hits left to report, the ones handed to the
+    // verifier may still be in its queue
+    uint64_t active_job() const { return m_active; }
+    uint64_t hashes() const { return m_hashes; }
+    uint64_t solutions() const { return m_solutions; }
+    uint64_t stale() const { return m_stale; }
+    uint64_t rejected() const { return m_rejected; }
+    const Histogram &drain() const { return m_drain; }
+    void report() const;
+};
+
+#endif // _SESSION_H
@@ -0,0 +1,195 @@
+#include <math.h>
+
+#include "session.hpp"
+#include "soak.hpp"
+
+// Soak
+
+void Soak::on_solution(uint64_t job, const ethash::search_result &sol)
+{
+    uint64_t source = 0;
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        auto it = m_jobs.find(job);
+        if (it == m_jobs.end())
+        {
+            m_lost++;
+            printf("SOAK: nonce %lu of unknown job %lu not submitted\n", sol.nonce, job);
+            return;
+        }
+        it->second.hits++;
+        source = it->second.source;
+    }
+
+    // the source numbers its jobs itself
+    Share share;
+    share.job = source;
+    share.sol = sol;
+    m_source.push_share(share);
+}
+
+void Soak::retire(uint64_t keep)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    while (!m_jobs.empty() && m_jobs.begin()->first < keep)
+    {
+        const SoakJob &j = m_jobs.begin()->second;
+        const double expected = j.p * j.hashes;
+        m_jobCount++;
+        m_hashes += j.hashes;
+        m_hits += j.hits;
+        m_expected += expected;
+        // hits of a job are Poisson, P(at least one) = 1 - e^-expected
+        m_jobsHit += j.hits > 0;
+        m_expectedJobsHit += -expm1(-expected);
+        m_jobs.erase(m_jobs.begin());
+    }
+}
+
+bool Soak::run()
+{
+    Verifier verifier([this](uint64_t job, const ethash::search_result &sol) { on_solution(job, sol); });
+    Session session(m_dev, nullptr, m_debug);
+    session.set_verifier(&verifier);
+    session.set_nonce_space(m_space);
+
+    m_source.start();
+    const auto t_start = steady_clock::now();
+    auto t_report = t_start;
+    auto t_done = t_start;
+    bool sourceDone = false;
+    uint64_t reportHashes = 0;
+
+    uint64_t current = 0;    // session job number of the job searched
+    uint64_t jobHashes = 0;  // session hashes when it was set
+    int epoch = -1;
+
+    while (!m_stop)
+    {
+        const auto now = steady_clock::now();
+        if (m_options.seconds && now - t_start >= seconds(m_options.seconds))
+            break;
+        if (m_source.done() && !sourceDone)
+        {
+            sourceDone = true;
+            t_done = now;
+        }
+        if (sourceDone && now - t_done >= milliseconds(m_options.lastJobMs))
+            break;
+
+        Job job;
+        if (m_source.next_job(job))
+        {
+            SoakJob j;
+            j.source = job.id;
+            j.epoch = job.epoch;
+            j.p = (get_target_value(job.boundary) + 1.0) / 18446744073709551616.0;
+
+            // The hashes of a job are counted up to the next set_job, the
+            // lease still running then goes to the new job. Over many jobs
+            // that evens out unless the difficulty changes with every job.
+            const uint64_t hashes = session.hashes();
+            {
+                std::lock_guard<std::mutex> guard(m_lock);
+                if (current)
+                    m_jobs[current].hashes = hashes - jobHashes;
+                // only this thread sets jobs, the session numbers them in order
+                current = session.job() + 1;
+                m_jobs[current] = j;
+            }
+            jobHashes = hashes;
+
+            if (epoch >= 0 && job.epoch != epoch)
+            {
+                m_epochs++;
+                printf("SOAK: epoch %d -> %d at job %lu\n", epoch, job.epoch, job.id);
+            }
+            epoch = job.epoch;
+            session.set_job(job.header, job.boundary, job.epoch, job.startNonce);
+            continue;
+        }
+
+        // The worker left the jobs before the active one, their hits are all
+        // with the verifier. Once it drained them they count.
+        const uint64_t active = session.active_job();
+        bool due;
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            due = !m_jobs.empty() && m_jobs.begin()->first < active;
+        }
+        if (due)
+        {
+            verifier.flush();
+            retire(active);
+        }
+
+        if (now - t_report >= seconds(m_options.reportSeconds))
+        {
+            const uint64_t hashes = session.hashes();
+            const double us = duration_cast<microseconds>(now - t_report).count();
+            const double rate = us > 0 ? (hashes - reportHashes) / us : 0;
+            m_rates.push_back(rate);
+            reportHashes = hashes;
+            t_report = now;
+
+            std::lock_guard<std::mutex> guard(m_lock);
+            printf("SOAK: %6.0fs %8.3f Mh/s, jobs %lu, epoch %d, hits %lu expected %.1f, invalid %lu\n",
+                   duration_cast<milliseconds>(now - t_start).count() / 1e3, rate, current, epoch, m_hits,
+                   m_expected, verifier.rejected() + session.rejected());
+            continue;
+        }
+
+        std::this_thread::sleep_for(milliseconds(1));
+    }
+
+    session.stop();
+    verifier.stop();
+    m_source.stop();
+
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        if (current)
+            m_jobs[current].hashes = session.hashes() - jobHashes;
+    }
+    retire(UINT64_MAX);
+
+    m_seconds = duration_cast<milliseconds>(steady_clock::now() - t_start).count() / 1e3;
+    m_invalid = verifier.rejected() + session.rejected();
+    m_stale = session.stale();
+    m_dropped = m_source.dropped();
+
+    session.report();
+    verifier.report();
+    return m_invalid == 0;
+}
+
+void Soak::report() const
+{
+    printf("SOAK: ran %.0fs, jobs %lu, epoch rollovers %lu, hashes %lu\n", m_seconds, m_jobCount, m_epochs, m_hashes);
+
+    // the median leaves out the intervals of DAG builds and other stalls
+    if (!m_rates.empty())
+    {
+        std::vector<double> r = m_rates;
+        std::sort(r.begin(), r.end());
+        const double median = r[r.size() / 2];
+        const size_t low = std::count_if(r.begin(), r.end(), [&](double x) {
+            return x < median * (100 - m_options.maxRateDrop) / 100;
+        });
+        printf("SOAK: hash rate %.3f Mh/s median, %.3f p10, %.3f p90 over %zu intervals, %zu below %u%% of the median\n",
+               median, r[r.size() / 10], r[r.size() * 9 / 10], r.size(), low, 100 - m_options.maxRateDrop);
+    }
+
+    // more than about 3 standard deviations off hints at lost or made up hits
+    const double z = m_expected > 0 ? (m_hits - m_expected) / sqrt(m_expected) : 0;
+    printf("SOAK: hits %lu, expected %.1f, z %.2f, jobs with hits %lu, expected %.1f\n",
+           m_hits, m_expected, z, m_jobsHit, m_expectedJobsHit);
+
+    const Histogram &sw = m_dev.get_metrics().jobSwitch;
+    if (sw.count())
+        printf("SOAK: job switch %.3f ms mean, %.3f ms p99, %.3f ms max\n",
+               sw.mean() / 1e6, sw.percentile(0.99) / 1e6, sw.max() / 1e6);
+
+    printf("SOAK: invalid %lu, stale %lu, shares dropped %lu, hits of unknown jobs %lu\n", m_invalid, m_stale,
+           m_dropped, m_lost.load());
+}
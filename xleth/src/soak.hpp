@@ -0,0 +1,92 @@
+#ifndef _SOAK_H
+#define _SOAK_H
+
+#include <map>
+#include <mutex>
+
+#include "backend.hpp"
+#include "noncespace.hpp"
+#include "worksource.hpp"
+
+//------------------------------------------------------------------------------
+// soak
+//------------------------------------------------------------------------------
+// Steady state run of one backend: every job of a work source goes to a
+// session as it arrives, hits are verified and handed back as shares. Every
+// reportSeconds a line with the hash rate of the interval, the jobs and the
+// hits found against the hits expected goes to stdout, report() sums up the
+// run. Meant to run unattended for hours, stop() ends it from any thread or
+// a signal handler.
+struct SoakOptions
+{
+    unsigned seconds = 0;       // 0: until stop() or the source runs dry
+    unsigned reportSeconds = 60;
+    unsigned lastJobMs = 2000;  // the last job of a finite source gets as long
+    unsigned maxRateDrop = 50;  // %, report intervals this far below the median
+};
+
+// hits of one job, the hashes are taken when the next job replaces it
+struct SoakJob
+{
+    uint64_t source = 0;   // Job::id of the source
+    int epoch = 0;
+    double p = 0;          // hit probability of one hash
+    uint64_t hashes = 0;
+    uint64_t hits = 0;
+};
+
+class Soak
+{
+protected:
+    EthBackend &m_dev;
+    WorkSource &m_source;
+    NonceSpace *m_space = nullptr;
+    SoakOptions m_options;
+    bool m_debug;
+
+    std::atomic<bool> m_stop{false};
+
+    // jobs by session job number, solutions keep arriving from the verifier
+    // threads for a while after a job is replaced
+    std::mutex m_lock;
+    std::map<uint64_t, SoakJob> m_jobs;
+
+    // totals of the jobs retired from m_jobs
+    uint64_t m_jobCount = 0;
+    uint64_t m_epochs = 0;       // rollovers seen
+    uint64_t m_hashes = 0;
+    uint64_t m_hits = 0;
+    double m_expected = 0;
+    uint64_t m_jobsHit = 0;      // jobs with one hit or more
+    double m_expectedJobsHit = 0;
+
+    // hash rate of every report interval, Mh/s
+    std::vector<double> m_rates;
+    double m_seconds = 0;
+    uint64_t m_invalid = 0;
+    uint64_t m_stale = 0;
+    uint64_t m_dropped = 0;
+    std::atomic<uint64_t> m_lost{0}; // hits of jobs already retired, never expected
+
+    void on_solution(uint64_t job, const ethash::search_result &sol);
+    // add the jobs before keep to the totals
+    void retire(uint64_t keep);
+
+public:
+    Soak(EthBackend &dev, WorkSource &source, const SoakOptions &options, bool debug = false)
+        : m_dev(dev), m_source(source), m_options(options), m_debug(debug)
+    {
+    }
+
+    // Lease the nonces of every job from a shared space. Set before run().
+    void set_nonce_space(NonceSpace *space) { m_space = space; }
+
+    // start the source and search its jobs until the run ends, false if it
+    // saw invalid results
+    bool run();
+    void stop() { m_stop = true; }
+
+    void report() const;
+};
+
+#endif // _SOAK_H
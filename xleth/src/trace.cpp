@@ -0,0 +1,117 @@
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "trace.hpp"
+
+std::atomic<bool> Tracer::s_on{false};
+
+// Tracer
+
+Tracer &Tracer::instance()
+{
+    static Tracer s_tracer;
+    return s_tracer;
+}
+
+int64_t Tracer::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int Tracer::thread_track()
+{
+    static std::atomic<int> s_next{0};
+    thread_local int t_track = -1;
+
+    if (t_track < 0)
+    {
+        t_track = s_next++;
+        instance().name_track(0, t_track, "thread " + std::to_string(t_track));
+    }
+    return t_track;
+}
+
+void Tracer::start()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_events.clear();
+        m_origin = now();
+    }
+    name_process(0, "host");
+    s_on = true;
+}
+
+void Tracer::complete(const char *name, const char *cat, int pid, int tid, int64_t start, int64_t dur,
+                      const std::string &args)
+{
+    if (!on())
+        return;
+
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_events.push_back(TraceEvent{name, cat, pid, tid, std::max<int64_t>(0, start - m_origin), dur, args});
+}
+
+void Tracer::name_process(int pid, const std::string &name)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_meta.push_back("{\"ph\": \"M\", \"name\": \"process_name\", \"pid\": " + std::to_string(pid) +
+                     ", \"args\": {\"name\": \"" + name + "\"}}");
+}
+
+void Tracer::name_track(int pid, int tid, const std::string &name)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_meta.push_back("{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": " + std::to_string(pid) +
+                     ", \"tid\": " + std::to_string(tid) + ", \"args\": {\"name\": \"" + name + "\"}}");
+}
+
+size_t Tracer::size()
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    return m_events.size();
+}
+
+bool Tracer::write(const std::string &path)
+{
+    const std::string tmp = path + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "w");
+    if (!fp)
+    {
+        printf("TRACE: cannot write %s\n", path.c_str());
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    // ts and dur are in us, fractions keep the ns
+    fprintf(fp, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    bool first = true;
+    for (auto &m : m_meta)
+    {
+        fprintf(fp, "%s  %s", first ? "" : ",\n", m.c_str());
+        first = false;
+    }
+    for (auto &ev : m_events)
+    {
+        fprintf(fp, "%s  {\"ph\": \"X\", \"name\": \"%s\", \"cat\": \"%s\", \"pid\": %d, \"tid\": %d, "
+                    "\"ts\": %.3f, \"dur\": %.3f, \"args\": {%s}}",
+                first ? "" : ",\n", ev.name, ev.cat, ev.pid, ev.tid, ev.ts / 1e3, ev.dur / 1e3, ev.args.c_str());
+        first = false;
+    }
+    fprintf(fp, "\n]}\n");
+
+    bool ok = fclose(fp) == 0 && rename(tmp.c_str(), path.c_str()) == 0;
+    if (ok)
+        printf("TRACE: %zu events written to %s\n", m_events.size(), path.c_str());
+    else
+    {
+        printf("TRACE: cannot write %s\n", path.c_str());
+        remove(tmp.c_str());
+    }
+    return ok;
+}
@@ -0,0 +1,86 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//------------------------------------------------------------------------------
+// trace
+//------------------------------------------------------------------------------
+// Timeline of host phases and device commands, written as Chrome trace-event
+// JSON (chrome://tracing, ui.perfetto.dev). Process 0 is the host with a
+// track per thread, every device is a process with a track per queue.
+// Disabled, a trace point costs one relaxed load and records nothing.
+
+// device tracks besides the search instances 0..K-1
+const int c_traceDagTrack = 64;
+
+struct TraceEvent
+{
+    const char *name; // literals only, nothing is copied on the hot path
+    const char *cat;
+    int pid;
+    int tid;
+    int64_t ts;  // ns since the trace started
+    int64_t dur; // ns
+    std::string args; // JSON object members, may be empty
+};
+
+class Tracer
+{
+protected:
+    static std::atomic<bool> s_on;
+
+    std::mutex m_lock;
+    std::vector<TraceEvent> m_events;
+    std::vector<std::string> m_meta; // process and thread names
+    int64_t m_origin = 0;
+
+public:
+    static Tracer &instance();
+    static bool on() { return s_on.load(std::memory_order_relaxed); }
+    // steady clock, ns
+    static int64_t now();
+    // track of the calling thread in the host process
+    static int thread_track();
+
+    void start();
+    void stop() { s_on = false; }
+
+    // a span on the host steady clock
+    void complete(const char *name, const char *cat, int pid, int tid, int64_t start, int64_t dur,
+                  const std::string &args = "");
+    void name_process(int pid, const std::string &name);
+    void name_track(int pid, int tid, const std::string &name);
+
+    size_t size();
+    bool write(const std::string &path);
+};
+
+// host phase from construction to destruction
+class TraceScope
+{
+protected:
+    const char *m_name;
+    const char *m_cat;
+    int64_t m_start;
+
+public:
+    std::string args; // filled by the traced code, only when Tracer::on()
+
+    TraceScope(const char *name, const char *cat = "host")
+        : m_name(name), m_cat(cat), m_start(Tracer::on() ? Tracer::now() : 0) {}
+    ~TraceScope()
+    {
+        if (m_start)
+            Tracer::instance().complete(m_name, m_cat, 0, Tracer::thread_track(), m_start,
+                                        Tracer::now() - m_start, args);
+    }
+    bool on() const { return m_start != 0; }
+};
+
+#endif // _TRACE_H
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "tuner.hpp"
+#include "dagcache.hpp"
+
+// TuneStore
+
+// OpenCL info strings may carry their terminating null and blank padding
+static std::string clean(const std::string &s)
+{
+    std::string out;
+    for (char c : s)
+    {
+        if (c == '\0')
+            continue;
+        // tabs and newlines separate the fields of the file
+        out += (c == '\t' || c == '\n' || c == '\r') ? ' ' : c;
+    }
+    size_t end = out.find_last_not_of(' ');
+    return out.substr(0, end == std::string::npos ? 0 : end + 1);
+}
+
+std::string TuneStore::key(const std::string &device, const std::string &driver,
+                           const std::string &kernelFile, const std::string &build)
+{
+    size_t slash = kernelFile.find_last_of('/');
+    std::string kernel = kernelFile.substr(slash == std::string::npos ? 0 : slash + 1);
+    struct stat st;
+    if (stat(kernelFile.c_str(), &st) == 0)
+        kernel += ":" + std::to_string((unsigned long long)st.st_size) + ":" + std::to_string((long long)st.st_mtime);
+
+    return clean(device) + "|" + clean(driver) + "|" + clean(kernel) + "|" + clean(build);
+}
+
+void TuneStore::load()
+{
+    m_loaded = true;
+    m_profiles.clear();
+
+    FILE *fp = fopen(m_path.c_str(), "r");
+    if (!fp)
+        return;
+
+    char line[1024];
+    while (fgets(line, sizeof(line), fp))
+    {
+        char *tab = strchr(line, '\t');
+        if (!tab || line[0] == '#')
+            continue;
+        *tab = 0;
+
+        TuneProfile p;
+        if (sscanf(tab + 1, "%u\t%u\t%u\t%lf\t%lf", &p.localWorkSize, &p.globalWorkSizeMultiplier,
+                   &p.dagChunkGroups, &p.hashRate, &p.dagRate) >= 3 &&
+            p.localWorkSize && p.globalWorkSizeMultiplier && p.dagChunkGroups)
+        {
+            m_profiles[line] = p;
+        }
+    }
+    fclose(fp);
+}
+
+bool TuneStore::find(const std::string &key, TuneProfile &profile)
+{
+    if (!enabled())
+        return false;
+    if (!m_loaded)
+        load();
+
+    auto it = m_profiles.find(key);
+    if (it == m_profiles.end())
+        return false;
+    profile = it->second;
+    return true;
+}
+
+bool TuneStore::save(const std::string &key, const TuneProfile &profile)
+{
+    if (!enabled())
+        return false;
+
+    // pick up profiles other processes saved meanwhile
+    load();
+    m_profiles[key] = profile;
+
+    size_t slash = m_path.rfind('/');
+    if (slash != std::string::npos && slash > 0)
+        make_dirs(m_path.substr(0, slash));
+
+    const std::string tmp = m_path + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "w");
+    if (!fp)
+    {
+        printf("TUNE: cannot write %s\n", tmp.c_str());
+        return false;
+    }
+
+    fprintf(fp, "# device|driver\tlws\tmultiplier\tdag chunk groups\tMh\tDAG items/s\n");
+    for (auto &it : m_profiles)
+    {
+        const TuneProfile &p = it.second;
+        fprintf(fp, "%s\t%u\t%u\t%u\t%.2f\t%.0f\n", it.first.c_str(), p.localWorkSize,
+                p.globalWorkSizeMultiplier, p.dagChunkGroups, p.hashRate, p.dagRate);
+    }
+
+    bool ok = (fclose(fp) == 0) && rename(tmp.c_str(), m_path.c_str()) == 0;
+    if (!ok)
+    {
+        printf("TUNE: cannot write %s\n", m_path.c_str());
+        remove(tmp.c_str());
+    }
+    return ok;
+}
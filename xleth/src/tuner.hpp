@@ -0,0 +1,54 @@
+#ifndef _TUNER_H
+#define _TUNER_H
+
+#include <map>
+#include <string>
+
+//------------------------------------------------------------------------------
+// tuning profiles
+//------------------------------------------------------------------------------
+// Best launch parameters found by EthDevce::tune(), one line per device in a
+// text file keyed by device name, driver version, kernel file and build:
+//   <device>|<driver>|<kernel>|<build> <tab> lws <tab> multiplier <tab> dag chunk <tab> Mh <tab> DAG items/s
+// The kernel is its file name, size and modification time, a rebuilt xclbin
+// or an edited source is tuned afresh.
+struct TuneProfile
+{
+    unsigned localWorkSize = 0;
+    unsigned globalWorkSizeMultiplier = 0;
+    unsigned dagChunkGroups = 0;
+    // measured when tuned, for reference only
+    double hashRate = 0;
+    double dagRate = 0;
+};
+
+class TuneStore
+{
+protected:
+    std::string m_path;
+    std::map<std::string, TuneProfile> m_profiles;
+    bool m_loaded = false;
+
+    void load();
+
+public:
+    TuneStore() {}
+    explicit TuneStore(const std::string &path) : m_path(path) {}
+
+    void set_path(const std::string &path)
+    {
+        m_path = path;
+        m_loaded = false;
+    }
+    bool enabled() const { return !m_path.empty(); }
+    const std::string &path() const { return m_path; }
+
+    // build: the definitions the kernel is built with, e.g. "p2 l0 i1 x1"
+    static std::string key(const std::string &device, const std::string &driver,
+                           const std::string &kernelFile, const std::string &build);
+    bool find(const std::string &key, TuneProfile &profile);
+    // update one profile and rewrite the file atomically
+    bool save(const std::string &key, const TuneProfile &profile);
+};
+
+#endif // _TUNER_H
@@ -0,0 +1,141 @@
+#include "verifier.hpp"
+
+static int64_t now_ns()
+{
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// EpochCache
+
+LightHandle EpochCache::get(int epoch)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    for (auto &ctx : m_ctx)
+        if (ctx && ctx->ctx.epoch_number == epoch)
+            return ctx;
+
+    // about a second when nobody holds it, the other threads wait for it anyway
+    LightHandle ctx = EpochManager::instance().get(epoch);
+    if (!ctx)
+        return ctx;
+
+    if (!m_ctx[0] || epoch > m_ctx[0]->ctx.epoch_number)
+    {
+        m_ctx[1] = m_ctx[0];
+        m_ctx[0] = ctx;
+    }
+    else
+        m_ctx[1] = ctx;
+    return ctx;
+}
+
+// Verifier
+
+Verifier::Verifier(SolutionHandler onValid, unsigned threads, bool debug)
+    : m_onValid(onValid), m_debug(debug)
+{
+    if (!threads)
+        threads = 2;
+    for (unsigned i = 0; i < threads; i++)
+        m_workers.emplace_back(&Verifier::worker, this);
+}
+
+void Verifier::submit(uint64_t job, int epoch, const ethash::hash256 &header, const ethash::hash256 &boundary,
+                      std::vector<ethash::search_result> sols)
+{
+    if (sols.empty())
+        return;
+
+    VerifyBatch batch;
+    batch.job = job;
+    batch.epoch = epoch;
+    batch.header = header;
+    batch.boundary = boundary;
+    batch.sols.swap(sols);
+    batch.queued = now_ns();
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_queue.push_back(std::move(batch));
+    }
+    m_wake.notify_one();
+}
+
+void Verifier::flush()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_idle.wait(lock, [&]() { return m_queue.empty() && !m_busy; });
+}
+
+void Verifier::stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        if (m_quit)
+            return;
+    }
+    // what is queued still gets verified and delivered
+    flush();
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_quit = true;
+    }
+    m_wake.notify_all();
+    for (auto &w : m_workers)
+        w.join();
+    m_workers.clear();
+}
+
+void Verifier::worker()
+{
+    for (;;)
+    {
+        VerifyBatch batch;
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            m_wake.wait(lock, [&]() { return m_quit || !m_queue.empty(); });
+            if (m_queue.empty())
+                break;
+            batch = std::move(m_queue.front());
+            m_queue.pop_front();
+            m_busy++;
+        }
+
+        TraceScope trace("verify batch");
+        if (trace.on())
+            trace.args = "\"job\": " + std::to_string(batch.job) + ", \"solutions\": " + std::to_string(batch.sols.size());
+
+        LightHandle light = m_cache.get(batch.epoch);
+        for (auto &sol : batch.sols)
+        {
+            if (light && ethash::verify(light->ctx, batch.header, sol.mix_hash, sol.nonce, batch.boundary))
+            {
+                m_verified++;
+                if (m_onValid)
+                    m_onValid(batch.job, sol);
+            }
+            else
+            {
+                m_rejected++;
+                printf("VER: job %lu nonce %lu rejected by verify\n", batch.job, sol.nonce);
+            }
+        }
+        m_batches++;
+        m_latency.record(now_ns() - batch.queued);
+
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            m_busy--;
+            if (m_queue.empty() && !m_busy)
+                m_idle.notify_all();
+        }
+    }
+}
+
+void Verifier::report() const
+{
+    printf("VER: batches %lu, verified %lu, rejected %lu", m_batches.load(), m_verified.load(), m_rejected.load());
+    if (m_latency.count())
+        printf(", %.3f ms mean, %.3f ms max per batch", m_latency.mean() / 1e6, m_latency.max() / 1e6);
+    printf("\n");
+}
@@ -0,0 +1,83 @@
+#ifndef _VERIFIER_H
+#define _VERIFIER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+#include "backend.hpp"
+
+//------------------------------------------------------------------------------
+// verifier
+//------------------------------------------------------------------------------
+// Checks device hits on a host thread pool before they are submitted, so a
+// faulty kernel never produces an invalid share and the device threads only
+// pay for handing a batch over.
+
+// hit of a job, jobs are numbered from 1 by Session::set_job()
+typedef std::function<void(uint64_t job, const ethash::search_result &sol)> SolutionHandler;
+
+// Holds the light caches of the newest epoch and the one before for all
+// verifier threads. Hits of the previous epoch still arrive right after a
+// rollover, anything older is fetched from the EpochManager on demand.
+class EpochCache
+{
+protected:
+    std::mutex m_lock;
+    LightHandle m_ctx[2]; // newest first
+
+public:
+    LightHandle get(int epoch);
+};
+
+struct VerifyBatch
+{
+    uint64_t job;
+    int epoch;
+    ethash::hash256 header;
+    ethash::hash256 boundary;
+    std::vector<ethash::search_result> sols;
+    int64_t queued; // ns, steady clock
+};
+
+class Verifier
+{
+protected:
+    EpochCache m_cache;
+    SolutionHandler m_onValid;
+    bool m_debug;
+
+    std::vector<std::thread> m_workers;
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    std::condition_variable m_idle;
+    std::deque<VerifyBatch> m_queue;
+    unsigned m_busy = 0;
+    bool m_quit = false;
+
+    std::atomic<uint64_t> m_batches{0};
+    std::atomic<uint64_t> m_verified{0};
+    std::atomic<uint64_t> m_rejected{0};
+    Histogram m_latency; // submit -> batch verified
+
+    void worker();
+
+public:
+    // threads 0: two, verification is cheap next to the search
+    Verifier(SolutionHandler onValid, unsigned threads = 0, bool debug = false);
+    ~Verifier() { stop(); }
+
+    // queue the hits of one scan and return at once
+    void submit(uint64_t job, int epoch, const ethash::hash256 &header, const ethash::hash256 &boundary,
+                std::vector<ethash::search_result> sols);
+    // wait until every queued batch is verified
+    void flush();
+    void stop();
+
+    uint64_t verified() const { return m_verified; }
+    uint64_t rejected() const { return m_rejected; }
+    void report() const;
+};
+
+#endif // _VERIFIER_H
@@ -0,0 +1,270 @@
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "worksource.hpp"
+
+// WorkSource
+
+void WorkSource::start()
+{
+    m_stop = false;
+    m_exhausted = false;
+    m_thread = std::thread(&WorkSource::loop, this);
+}
+
+void WorkSource::stop()
+{
+    m_stop = true;
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+void WorkSource::loop()
+{
+    Job job;
+    bool haveJob = false;
+    Share share;
+
+    for (;;)
+    {
+        while (m_shares.try_pop(share))
+        {
+            submit(share);
+            m_shareCount++;
+        }
+        if (m_stop)
+            break;
+
+        // a full ring holds the job back, the devices are behind anyway
+        if (haveJob && m_jobs.try_push(job))
+        {
+            haveJob = false;
+            m_jobCount++;
+        }
+
+        if (haveJob || m_exhausted)
+        {
+            std::this_thread::sleep_for(milliseconds(1));
+            continue;
+        }
+
+        // short waits, shares are submitted in between
+        const int rc = fetch(job, 10);
+        if (rc > 0)
+            haveJob = true;
+        else if (rc < 0)
+            m_exhausted = true;
+    }
+}
+
+// ReplaySource
+
+ReplaySource::ReplaySource(const std::string &path, const std::string &sharesPath)
+    : m_path(path)
+{
+    m_fd = (path == "-") ? dup(STDIN_FILENO) : open(path.c_str(), O_RDONLY);
+    if (m_fd < 0)
+        printf("SRC: cannot open %s\n", path.c_str());
+
+    if (!sharesPath.empty())
+    {
+        m_out = fopen(sharesPath.c_str(), "w");
+        if (!m_out)
+            printf("SRC: cannot write %s\n", sharesPath.c_str());
+    }
+}
+
+ReplaySource::~ReplaySource()
+{
+    // the loop must not call submit() of a destroyed source
+    stop();
+    if (m_fd >= 0)
+        close(m_fd);
+    if (m_out)
+        fclose(m_out);
+}
+
+int ReplaySource::read_line(std::string &line, int timeoutMs)
+{
+    for (;;)
+    {
+        const size_t nl = m_buf.find('\n');
+        if (nl != std::string::npos)
+        {
+            line = m_buf.substr(0, nl);
+            m_buf.erase(0, nl + 1);
+            return 1;
+        }
+        if (m_eof || m_fd < 0)
+        {
+            if (m_buf.empty())
+                return -1;
+            line.swap(m_buf); // last line without newline
+            m_buf.clear();
+            return 1;
+        }
+
+        // a pipe may stay silent, never block the loop for longer
+        struct pollfd pfd = {m_fd, POLLIN, 0};
+        if (poll(&pfd, 1, timeoutMs) <= 0)
+            return 0;
+
+        char chunk[4096];
+        const ssize_t n = read(m_fd, chunk, sizeof(chunk));
+        if (n <= 0)
+            m_eof = true;
+        else
+            m_buf.append(chunk, n);
+    }
+}
+
+static bool parse_hash(const char *hex, ethash::hash256 &h)
+{
+    if (hex[0] == '0' && (hex[1] == 'x' || hex[1] == 'X'))
+        hex += 2;
+    if (strlen(hex) != 64 || strspn(hex, "0123456789abcdefABCDEF") != 64)
+        return false;
+    h = to_hash256(hex);
+    return true;
+}
+
+int ReplaySource::fetch(Job &job, int timeoutMs)
+{
+    while (!m_havePending)
+    {
+        std::string line;
+        const int rc = read_line(line, timeoutMs);
+        if (rc <= 0)
+            return rc;
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        unsigned delay;
+        int epoch;
+        char header[80], boundary[80];
+        unsigned long long start = 0;
+        if (sscanf(line.c_str(), "%u %d %79s %79s %llu", &delay, &epoch, header, boundary, &start) < 4 ||
+            !parse_hash(header, m_pending.header) || !parse_hash(boundary, m_pending.boundary))
+        {
+            printf("SRC: bad job line \"%s\"\n", line.c_str());
+            continue;
+        }
+        m_pending.epoch = epoch;
+        m_pending.startNonce = start;
+        m_pending.id = m_nextId++;
+        m_due = steady_clock::now() + milliseconds(delay);
+        m_havePending = true;
+    }
+
+    const auto now = steady_clock::now();
+    if (now < m_due)
+    {
+        std::this_thread::sleep_for(std::min(m_due - now, (steady_clock::duration)milliseconds(timeoutMs)));
+        if (steady_clock::now() < m_due)
+            return 0;
+    }
+
+    job = m_pending;
+    m_havePending = false;
+    return 1;
+}
+
+void ReplaySource::submit(const Share &share)
+{
+    if (m_out)
+    {
+        fprintf(m_out, "%lu %lu %s\n", share.job, share.sol.nonce, to_hex(share.sol.mix_hash).c_str());
+        fflush(m_out);
+    }
+}
+
+std::string ReplaySource::format(const Job &job, unsigned delayMs)
+{
+    return std::to_string(delayMs) + " " + std::to_string(job.epoch) + " " + to_hex(job.header) + " " +
+           to_hex(job.boundary) + " " + std::to_string(job.startNonce);
+}
+
+// SyntheticSource
+
+SyntheticSource::SyntheticSource(int epoch, unsigned jobMs, const std::vector<uint64_t> &difficulties,
+                                 unsigned diffJobs, unsigned epochJobs, uint64_t maxJobs, uint64_t seed)
+    : m_epoch(epoch), m_jobMs(jobMs), m_difficulties(difficulties), m_diffJobs(diffJobs),
+      m_epochJobs(epochJobs), m_maxJobs(maxJobs), m_rng(seed)
+{
+    if (m_difficulties.empty())
+        m_difficulties.push_back(1);
+    m_due = steady_clock::now();
+}
+
+SyntheticSource::~SyntheticSource()
+{
+    // the loop must not fetch from a destroyed source
+    stop();
+    if (m_record)
+        fclose(m_record);
+}
+
+bool SyntheticSource::record(const std::string &path)
+{
+    m_record = fopen(path.c_str(), "w");
+    if (!m_record)
+        printf("SRC: cannot write %s\n", path.c_str());
+    return m_record != nullptr;
+}
+
+ethash::hash256 SyntheticSource::boundary(uint64_t difficulty)
+{
+    // long division of 2^256 - 1, a 64-bit word at a time
+    ethash::hash256 b = {};
+    const uint64_t d = std::max<uint64_t>(1, difficulty);
+    unsigned __int128 rem = 0;
+    for (int w = 0; w < 4; w++)
+    {
+        const unsigned __int128 cur = (rem << 64) | UINT64_MAX;
+        const uint64_t q = (uint64_t)(cur / d);
+        rem = cur % d;
+        for (int i = 0; i < 8; i++)
+            b.bytes[w * 8 + i] = (uint8_t)(q >> (56 - 8 * i));
+    }
+    return b;
+}
+
+int SyntheticSource::fetch(Job &job, int timeoutMs)
+{
+    if (m_maxJobs && m_nextId > m_maxJobs)
+        return -1;
+
+    const auto now = steady_clock::now();
+    if (now < m_due)
+    {
+        std::this_thread::sleep_for(std::min(m_due - now, (steady_clock::duration)milliseconds(timeoutMs)));
+        if (steady_clock::now() < m_due)
+            return 0;
+    }
+
+    // the schedule does not drift with the devices, a late job moves it
+    m_due = std::max(m_due + milliseconds(m_jobMs), steady_clock::now());
+
+    const uint64_t n = m_nextId - 1;
+    if (m_epochJobs && n && n % m_epochJobs == 0)
+        m_epoch++;
+    const uint64_t diff = m_difficulties[m_diffJobs ? (n / m_diffJobs) % m_difficulties.size() : 0];
+
+    job.id = m_nextId++;
+    for (int i = 0; i < 4; i++)
+    {
+        const uint64_t r = m_rng();
+        memcpy(job.header.bytes + 8 * i, &r, 8);
+    }
+    job.boundary = boundary(diff);
+    job.epoch = m_epoch;
+    job.startNonce = 0;
+
+    if (m_record)
+    {
+        fprintf(m_record, "%s\n", ReplaySource::format(job, job.id > 1 ? m_jobMs : 0).c_str());
+        fflush(m_record);
+    }
+    return 1;
+}
@@ -0,0 +1,143 @@
+#ifndef _WORKSOURCE_H
+#define _WORKSOURCE_H
+
+#include <random>
+#include <string>
+
+#include "backend.hpp"
+#include "queue.hpp"
+
+//------------------------------------------------------------------------------
+// work source
+//------------------------------------------------------------------------------
+// Producer of jobs and consumer of shares, a pool connection in production.
+// All of its I/O runs on its own thread: jobs reach the device side through
+// an SPSC ring and shares of any number of device threads come back through
+// an MPSC ring, so the device threads never wait on the network or a file.
+struct Job
+{
+    uint64_t id = 0; // numbered by the source from 1
+    ethash::hash256 header = {};
+    ethash::hash256 boundary = {};
+    int epoch = 0;
+    uint64_t startNonce = 0;
+};
+
+struct Share
+{
+    uint64_t job = 0;
+    ethash::search_result sol;
+};
+
+class WorkSource
+{
+protected:
+    SpscQueue<Job> m_jobs;
+    MpscQueue<Share> m_shares;
+    std::thread m_thread;
+    std::atomic<bool> m_stop{false};
+    std::atomic<bool> m_exhausted{false};
+
+    std::atomic<uint64_t> m_jobCount{0};
+    std::atomic<uint64_t> m_shareCount{0};
+    std::atomic<uint64_t> m_dropped{0}; // shares lost to a full ring
+
+    void loop();
+
+    // Source thread side. fetch() waits up to timeoutMs for the next job and
+    // returns 1 with one, 0 on timeout and -1 once no more jobs will come.
+    virtual int fetch(Job &job, int timeoutMs) = 0;
+    virtual void submit(const Share &share) = 0;
+
+public:
+    WorkSource(size_t jobSlots = 16, size_t shareSlots = 1024) : m_jobs(jobSlots), m_shares(shareSlots) {}
+    virtual ~WorkSource() { stop(); }
+
+    void start();
+    // submits the shares still queued before it returns
+    void stop();
+
+    // device side, never block
+    bool next_job(Job &job) { return m_jobs.try_pop(job); }
+    bool push_share(const Share &share)
+    {
+        if (m_shares.try_push(share))
+            return true;
+        m_dropped++;
+        return false;
+    }
+    // no job left to fetch or to take
+    bool done() const { return m_exhausted && m_jobs.size() == 0; }
+
+    uint64_t jobs() const { return m_jobCount; }
+    uint64_t shares() const { return m_shareCount; }
+    uint64_t dropped() const { return m_dropped; }
+};
+
+// Stand-in of a pool, replays recorded jobs from a file or a pipe ("-" is
+// stdin), one per line:
+//   <delay ms> <epoch> <header hex> <boundary hex> [start nonce]
+// The delay counts from the previous job. Shares go to a file as lines of
+//   <job> <nonce> <mix hex>
+class ReplaySource : public WorkSource
+{
+protected:
+    std::string m_path;
+    int m_fd = -1;
+    std::string m_buf; // read, not yet parsed
+    bool m_eof = false;
+    FILE *m_out = nullptr;
+
+    Job m_pending;
+    bool m_havePending = false;
+    steady_clock::time_point m_due;
+    uint64_t m_nextId = 1;
+
+    int read_line(std::string &line, int timeoutMs);
+    int fetch(Job &job, int timeoutMs) override;
+    void submit(const Share &share) override;
+
+public:
+    ReplaySource(const std::string &path, const std::string &sharesPath = "");
+    ~ReplaySource();
+    bool is_open() const { return m_fd >= 0; }
+
+    // a job in the replay format
+    static std::string format(const Job &job, unsigned delayMs);
+};
+
+// Stand-in of a pool for soak runs: a random header every jobMs, the
+// boundary steps to the next difficulty every diffJobs jobs and the epoch
+// rolls over every epochJobs jobs (0: never). Runs until stopped, or for
+// maxJobs jobs. Shares are only counted.
+class SyntheticSource : public WorkSource
+{
+protected:
+    int m_epoch;
+    unsigned m_jobMs;
+    std::vector<uint64_t> m_difficulties;
+    unsigned m_diffJobs;
+    unsigned m_epochJobs;
+    uint64_t m_maxJobs;
+    std::mt19937_64 m_rng;
+    FILE *m_record = nullptr;
+
+    steady_clock::time_point m_due;
+    uint64_t m_nextId = 1;
+
+    int fetch(Job &job, int timeoutMs) override;
+    void submit(const Share &) override {}
+
+public:
+    SyntheticSource(int epoch, unsigned jobMs, const std::vector<uint64_t> &difficulties, unsigned diffJobs = 0,
+                    unsigned epochJobs = 0, uint64_t maxJobs = 0, uint64_t seed = 1);
+    ~SyntheticSource();
+
+    // write every job in the ReplaySource format, the run can be replayed
+    bool record(const std::string &path);
+
+    // 2^256 / difficulty, big endian like every boundary
+    static ethash::hash256 boundary(uint64_t difficulty);
+};
+
+#endif // _WORKSOURCE_H
@@ -2,37 +2,6 @@
 
 #include "xleth.hpp"
 
-void hex_dump(const char *hdr, uint8_t *data, size_t len)
-{
-    auto *ptr = data;
-
-    printf("%s", hdr);
-
-    for (int i = 0; i < len; i++, ptr++)
-    {
-        if (i > 0 && i % 64 == 0)
-        {
-            printf("\n");
-        }
-        printf("%02x", *ptr);
-        if (i > 0 && (i%4) == 0)
-            printf(" ");
-    }
-    std::cout << std::endl;
-}
-
-uint64_t get_target_value(ethash::hash256 &boundary)
-{
-    uint8_t tmp[8];
-    uint64_t *pval = (uint64_t *)tmp;
-
-    memcpy(tmp, boundary.bytes, 8);
-    std::reverse(tmp, tmp + sizeof(tmp));
-    const uint64_t target = *pval;
-
-    return target;
-}
-
 // EthDev
 
 vector<unsigned char> EthDevce::read_binary_file(const char *xclbin_file_name)
@@ -62,7 +31,13 @@ vector<cl::Device> EthDevce::get_devices(const string &platform_name)
     size_t i;
     cl_int err;
     std::vector<cl::Platform> platforms;
-    OCL_CHECK(err, err = cl::Platform::get(&platforms));
+    err = cl::Platform::get(&platforms);
+    if (err != CL_SUCCESS || platforms.empty())
+    {
+        // no ICD installed (e.g. CI nodes without accelerator), not fatal
+        std::cout << "Error: No OpenCL platform available (error " << err << ")" << std::endl;
+        return vector<cl::Device>{};
+    }
     cl::Platform platform;
     for (i = 0; i < platforms.size(); i++)
     {
@@ -87,13 +62,22 @@ vector<cl::Device> EthDevce::get_devices(const string &platform_name)
 
     if (!platform_name.compare("Xilinx"))
     {
-        OCL_CHECK(err,
-                    err = platform.getDevices(CL_DEVICE_TYPE_ACCELERATOR, &devices));
+        err = platform.getDevices(CL_DEVICE_TYPE_ACCELERATOR, &devices);
     }
     else
     {
-        OCL_CHECK(err,
-                    err = platform.getDevices(CL_DEVICE_TYPE_GPU, &devices));
+        err = platform.getDevices(CL_DEVICE_TYPE_GPU, &devices);
+        if (err != CL_SUCCESS || devices.empty())
+        {
+            // CPU OpenCL implementations (pocl, Intel CPU runtime) have no GPU device
+            devices.clear();
+            err = platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
+        }
+    }
+    if (err != CL_SUCCESS)
+    {
+        std::cout << "Error: No device found on platform " << platform_name << std::endl;
+        return vector<cl::Device>{};
     }
     return devices;
 }
@@ -108,6 +92,7 @@ void EthDevce::add_definition(char const *_id, unsigned _value)
 
 bool EthDevce::load_kernel()
 {
+    TraceScope trace("load_kernel");
     cl_int err;
 
     auto devices = get_devices(m_platform_name);
@@ -118,12 +103,51 @@ bool EthDevce::load_kernel()
         return false;
     }
 
-    m_device = devices[0];
+    if (m_deviceIndex >= devices.size())
+    {
+        std::cout << "device " << m_deviceIndex << " not found on platform " << m_platform_name << std::endl;
+        return false;
+    }
+    m_device = devices[m_deviceIndex];
+
+    // a new context, buffers of a previous load are not valid in it
+    if (m_dagThread.joinable())
+        m_dagThread.join();
+    for (auto &dag : m_dag)
+        dag = DagSlot();
+    m_light.clear();
+    m_header.clear();
+    release_search_buffers();
+    m_headerEvent = cl::Event();
+    m_searchTarget = 0;
+    m_searchTarget2 = 0;
+    m_knl_loaded = false;
+
+    // the cached items of a light search are one buffer
+    if (m_settings.lightSearch)
+        m_settings.dagParts = 1;
+
+    // a tuned profile of this device replaces the default launch parameters
+    TuneProfile profile;
+    if (!m_tuning && m_tuneStore.find(tune_key(), profile))
+    {
+        // an xclbin is built for one work-group size
+        if (!m_binary)
+            m_settings.localWorkSize = profile.localWorkSize;
+        m_settings.globalWorkSizeMultiplier = profile.globalWorkSizeMultiplier;
+        m_settings.dagChunkGroups = profile.dagChunkGroups;
+        std::cout << "TUNE: using profile of " << tune_key() << std::endl;
+    }
 
     // Creating Context and Command Queue for selected Device
     OCL_CHECK(err, m_context = cl::Context(m_device, NULL, NULL, NULL, &err));
     OCL_CHECK(err, m_queue = cl::CommandQueue(m_context, m_device,
                                                 CL_QUEUE_PROFILING_ENABLE, &err));
+    // DAGs for the next epoch are built on their own queue beside the search
+    OCL_CHECK(err, m_dagQueue = cl::CommandQueue(m_context, m_device,
+                                                   CL_QUEUE_PROFILING_ENABLE, &err));
+    // abort() must not wait behind the batches it stops
+    OCL_CHECK(err, m_abortQueue = cl::CommandQueue(m_context, m_device, 0, &err));
 
     std::cout << "Trying to program device " << m_device.getInfo<CL_DEVICE_NAME>() << std::endl;
 
@@ -139,10 +163,15 @@ bool EthDevce::load_kernel()
         // std::string code((std::istreambuf_iterator<char>(t)), std::istreambuf_iterator<char>());
         m_code = std::string((std::istreambuf_iterator<char>(t)), std::istreambuf_iterator<char>());
 
+        // the definitions below are per load, keep only the caller's ones
+        const size_t userDefinitions = m_definitions.size();
         add_definition("WORKSIZE", m_settings.localWorkSize);
         add_definition("ACCESSES", 64);
         add_definition("MAX_OUTPUTS", c_maxSearchResults);
         add_definition("PLATFORM", 1); // 1:OPENCL_PLATFORM_AMD
+        add_definition("DAG_PARTS", m_settings.dagParts);
+        if (m_settings.lightSearch)
+            add_definition("LIGHT_SEARCH", 1);
         if (m_settings.noExit == false)
             add_definition("FAST_EXIT", 1);
 
@@ -150,19 +179,60 @@ bool EthDevce::load_kernel()
         for(auto it : m_definitions) {
             m_code.insert(m_code.begin(), it.c_str(), it.c_str() + strlen(it.c_str()));
         }
+        m_definitions.resize(userDefinitions);
 
-        cl::Program::Sources sources{{m_code.data(), m_code.size()}};
-        m_program = cl::Program(m_context, sources);
         char options[256] = {0};
-        m_program.build({m_device}, options);
+        const std::string key = ProgramCache::key(m_code, options,
+                                                  m_device.getInfo<CL_DEVICE_NAME>(),
+                                                  m_device.getInfo<CL_DRIVER_VERSION>());
+
+        // a binary built earlier for this source, device and driver
+        bool built = false;
+        std::vector<unsigned char> cached;
+        if (m_programCache.load(key, cached))
+        {
+            cl::Program::Binaries bins{{cached.data(), cached.size()}};
+            m_program = cl::Program(m_context, {m_device}, bins, NULL, &err);
+            if (err == CL_SUCCESS)
+                err = m_program.build({m_device}, options);
+            built = (err == CL_SUCCESS);
+            if (built)
+                std::cout << "KNL: program loaded from " << m_programCache.path(key) << std::endl;
+            else
+            {
+                std::cout << "KNL: cached program rejected (" << err << "), rebuilding" << std::endl;
+                m_programCache.remove(key);
+            }
+        }
+
+        if (!built)
+        {
+            cl::Program::Sources sources{{m_code.data(), m_code.size()}};
+            m_program = cl::Program(m_context, sources);
+            err = m_program.build({m_device}, options);
+
+            if (err == CL_SUCCESS && m_programCache.enabled())
+            {
+                auto binaries = m_program.getInfo<CL_PROGRAM_BINARIES>();
+                if (binaries.size() == 1 && m_programCache.store(key, binaries[0]))
+                    std::cout << "KNL: program saved to " << m_programCache.path(key) << std::endl;
+            }
+        }
     }
 
     if (err == CL_SUCCESS)
     {
         std::cout << "Device program successful.\n";
         OCL_CHECK(err, m_dagKernel = cl::Kernel(m_program, "GenerateDAG", &err));
-        OCL_CHECK(err, m_searchKernel = cl::Kernel(m_program, "search", &err));
-        m_knl_loaded = true;
+        create_search_instances();
+        // an xclbin of an older kernel takes fewer arguments and writes
+        // another results layout, it would search without finding anything
+        const cl_uint args = m_searchKernel.getInfo<CL_KERNEL_NUM_ARGS>();
+        const cl_uint expected = arg_secondary_target() + 1 + (m_settings.lightSearch ? 3 : 0);
+        if (args == expected)
+            m_knl_loaded = true;
+        else
+            printf("KNL: search takes %u arguments, %u expected, rebuild the xclbin\n", args, expected);
     }
     else
     {
@@ -173,22 +243,76 @@ bool EthDevce::load_kernel()
     printf("KNL: MULTIPLIER %u\n", m_settings.globalWorkSizeMultiplier);
     printf("KNL: G_WORKSIZE %u\n", m_settings.localWorkSize * m_settings.localWorkSize);
     printf("KNL: FASTEXIT   %u\n", (m_settings.noExit) ? 0:1);
+    printf("KNL: DAG_PARTS  %u\n", m_settings.dagParts);
+    if (m_settings.lightSearch)
+        printf("KNL: LIGHT      %u items cached\n", m_settings.cachedItems);
+    if (Tracer::on())
+    {
+        Tracer &tracer = Tracer::instance();
+        tracer.name_process(trace_pid(), "OpenCL " + m_device.getInfo<CL_DEVICE_NAME>());
+        for (unsigned k = 0; k < m_settings.searchInstances; k++)
+            tracer.name_track(trace_pid(), k, "search " + std::to_string(k));
+        tracer.name_track(trace_pid(), c_traceDagTrack, "DAG");
+    }
+    if (m_knl_loaded && m_settings.searchInstances > 1)
+        printf("KNL: INSTANCES  %u on %s\n", m_settings.searchInstances,
+               m_searchQueues.size() > 1 ? "a queue each" : "an out-of-order queue");
 
     return m_knl_loaded;
 }
 
-bool EthDevce::get_context(int epoch)
+void EthDevce::create_search_instances()
 {
-    ethash::epoch_context _ec = ethash::get_global_epoch_context(epoch);
+    cl_int err;
+    const unsigned instances = m_settings.searchInstances;
 
-    m_epochContext.epochNumber = epoch;
-    m_epochContext.lightNumItems = _ec.light_cache_num_items;
-    m_epochContext.lightSize = ethash::get_light_cache_size(_ec.light_cache_num_items);
-    m_epochContext.dagNumItems = _ec.full_dataset_num_items;
-    m_epochContext.dagSize = ethash::get_full_dataset_size(_ec.full_dataset_num_items);
-    m_epochContext.lightCache = _ec.light_cache;
+    m_searchKernels.clear();
+    m_searchQueues.clear();
 
-    return true;
+    for (unsigned k = 0; k < instances; k++)
+    {
+        // an xclbin linked with nk=search:K has compute units search_1..K,
+        // bind each instance to one, XRT would schedule them all on any
+        cl::Kernel knl;
+        if (m_binary && instances > 1 && !strcmp(m_platform_name, "Xilinx"))
+        {
+            const std::string cu = "search:{search_" + std::to_string(k + 1) + "}";
+            knl = cl::Kernel(m_program, cu.c_str(), &err);
+            if (err != CL_SUCCESS)
+                printf("KNL: no compute unit %s, instance %u shares them\n", cu.c_str(), k);
+        }
+        if (!knl())
+        {
+            OCL_CHECK(err, knl = cl::Kernel(m_program, "search", &err));
+        }
+        m_searchKernels.push_back(knl);
+    }
+    m_searchKernel = m_searchKernels[0];
+
+    // one instance keeps the in-order queue, its batches chain anyway
+    if (instances == 1)
+    {
+        m_searchQueues.push_back(m_queue);
+        return;
+    }
+
+    const cl_command_queue_properties props = m_device.getInfo<CL_DEVICE_QUEUE_PROPERTIES>();
+    if (!m_settings.instanceQueues && (props & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE))
+    {
+        // batches only wait for the events they are given
+        cl::CommandQueue queue;
+        OCL_CHECK(err, queue = cl::CommandQueue(m_context, m_device,
+                                                CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE | CL_QUEUE_PROFILING_ENABLE, &err));
+        m_searchQueues.push_back(queue);
+        return;
+    }
+
+    for (unsigned k = 0; k < instances; k++)
+    {
+        cl::CommandQueue queue;
+        OCL_CHECK(err, queue = cl::CommandQueue(m_context, m_device, CL_QUEUE_PROFILING_ENABLE, &err));
+        m_searchQueues.push_back(queue);
+    }
 }
 
 void EthDevce::disp_device()
@@ -217,206 +341,1127 @@ void EthDevce::disp_device()
     std::cout << "DEV: Max compute unit " << max_c_uint << std::endl;
 }
 
-bool EthDevce::gen_dag(int epoch)
+// item i is in part i % parts, the first parts get one item more
+static std::vector<uint64_t> dag_part_sizes(int dagNumItems, unsigned parts)
 {
-    cl_int err;
+    std::vector<uint64_t> size(parts);
+    for (unsigned p = 0; p < parts; p++)
+        size[p] = ((uint64_t)dagNumItems + parts - 1 - p) / parts * ethash::full_dataset_item_size;
+    return size;
+}
 
+bool EthDevce::gen_dag(int epoch)
+{
     if (!m_knl_loaded)
     {
         std::cout << "Kernel is not loaded !!!" << std::endl;
         return false;
     }
 
-    std::cout << "DAG: generating for epoch " << epoch << " ..." << std::endl;
-    get_context(epoch);
+    if (m_dagThread.joinable())
+        m_dagThread.join();
 
-    m_dag.clear();
-    if (m_epochContext.dagNumItems & 1)
+    // the spare slot may hold it already from prepare_dag()
+    const unsigned slot = m_activeDag ^ 1;
+    if (m_dag[slot].epoch != epoch)
     {
-        m_dag.push_back(
-            cl::Buffer(m_context, CL_MEM_READ_ONLY, m_epochContext.dagSize / 2 + 64));
-        m_dag.push_back(
-            cl::Buffer(m_context, CL_MEM_READ_ONLY, m_epochContext.dagSize / 2 - 64));
+        std::cout << "DAG: generating for epoch " << epoch << " ..." << std::endl;
+        if (!build_dag(slot, epoch, m_queue))
+            return false;
     }
-    else
+
+    activate_dag(slot);
+    return true;
+}
+
+bool EthDevce::prepare_dag(int epoch)
+{
+    if (!m_knl_loaded)
+        return false;
+
+    if (m_dagThread.joinable())
+    {
+        if (!m_dagReady)
+            return false; // one build at a time
+        m_dagThread.join();
+    }
+
+    const unsigned slot = m_activeDag ^ 1;
+    if (m_dag[slot].epoch == epoch || m_dag[m_activeDag].epoch == epoch)
+        return true;
+
+    std::cout << "DAG: preparing epoch " << epoch << " in background ..." << std::endl;
+    m_dagReady = false;
+    m_dagThread = std::thread([this, slot, epoch]() {
+        build_dag(slot, epoch, m_dagQueue);
+        m_dagReady = true;
+    });
+
+    return true;
+}
+
+bool EthDevce::switch_dag(int epoch)
+{
+    if (m_dag[m_activeDag].epoch == epoch)
+        return true;
+
+    // only stalls when the background build has not finished yet
+    if (m_dagThread.joinable())
+        m_dagThread.join();
+
+    const unsigned slot = m_activeDag ^ 1;
+    if (m_dag[slot].epoch != epoch)
+        return gen_dag(epoch);
+
+    activate_dag(slot);
+    std::cout << "DAG: switched to epoch " << epoch << std::endl;
+    return true;
+}
+
+void EthDevce::activate_dag(unsigned slot)
+{
+    cl_int err;
+
+    m_activeDag = slot;
+    m_epochContext = m_dag[slot].ec;
+
+    // the only search arguments depending on the epoch
+    for (auto &knl : m_searchKernels)
+    {
+        for (unsigned p = 0; p < m_settings.dagParts; p++)
+        {
+            OCL_CHECK(err, err = knl.setArg(2 + p, m_dag[slot].buf[p]));
+        }
+        OCL_CHECK(err, err = knl.setArg(arg_dag_size(), m_epochContext.dagNumItems));
+        if (m_settings.lightSearch)
+        {
+            const uint32_t cached = std::min<uint32_t>(m_settings.cachedItems, m_epochContext.dagNumItems);
+            OCL_CHECK(err, err = knl.setArg(arg_light(), m_dag[slot].light));
+            OCL_CHECK(err, err = knl.setArg(arg_light() + 1, (uint32_t)(m_epochContext.lightSize / 64)));
+            OCL_CHECK(err, err = knl.setArg(arg_light() + 2, cached));
+        }
+    }
+}
+
+std::vector<uint64_t> EthDevce::alloc_dag(unsigned slot, int epoch)
+{
+    DagSlot &dag = m_dag[slot];
+    EpochContext &ec = dag.ec;
+
+    dag.epoch = -1;
+    get_context(epoch, ec, false); // sizes only, a DAG file needs no light cache
+
+    const unsigned parts = m_settings.dagParts;
+    std::vector<uint64_t> partSize = dag_part_sizes(ec.dagNumItems, parts);
+
+    // size the buffers for the next epoch too, so they are reused rather
+    // than freed and reallocated at every epoch
+    std::vector<uint64_t> capacity = dag_part_sizes(ethash::calculate_full_dataset_num_items(epoch + 1), parts);
+    if (m_settings.lightSearch)
     {
-        m_dag.push_back(
-            cl::Buffer(m_context, CL_MEM_READ_ONLY, (m_epochContext.dagSize) / 2));
-        m_dag.push_back(
-            cl::Buffer(m_context, CL_MEM_READ_ONLY, (m_epochContext.dagSize) / 2));
+        // only the cached items, GenerateDAG writes whole work-groups of
+        // nodes and the kernel needs a buffer even without any
+        const uint64_t lws = m_settings.localWorkSize;
+        const uint64_t nodes = (uint64_t)std::min<uint32_t>(m_settings.cachedItems, ec.dagNumItems) * 2;
+        partSize = {nodes * 64};
+        capacity = {std::max<uint64_t>(1, (nodes + lws - 1) / lws) * lws * 64};
+    }
+    dag.buf.resize(parts);
+    dag.capacity.resize(parts, 0);
+    for (unsigned i = 0; i < parts; i++)
+    {
+        if (dag.capacity[i] >= partSize[i])
+            continue;
+
+        if (m_settings.bankPlacement)
+        {
+            cl_int err;
+            // in the banks the connectivity config gives search argument
+            // _g_dag<i>, GenerateDAG writes the same banks through _DAG<i>
+            cl_mem_ext_ptr_t ext;
+            ext.flags = 2 + i;
+            ext.obj = nullptr;
+            ext.param = m_searchKernel();
+            OCL_CHECK(err, dag.buf[i] = cl::Buffer(m_context, CL_MEM_READ_ONLY | CL_MEM_EXT_PTR_XILINX,
+                                                   capacity[i], &ext, &err));
+        }
+        else
+            dag.buf[i] = cl::Buffer(m_context, CL_MEM_READ_ONLY, capacity[i]);
+        dag.capacity[i] = capacity[i];
     }
 
+    return partSize;
+}
+
+void EthDevce::upload_light(unsigned slot, cl::CommandQueue &queue)
+{
+    cl_int err;
+    DagSlot &dag = m_dag[slot];
+    EpochContext &ec = dag.ec;
+
+    if (!ec.light)
+        get_context(ec.epochNumber, ec);
+
     m_light.clear();
-    m_light.emplace_back(m_context, CL_MEM_READ_ONLY, m_epochContext.lightSize);
+    m_light.emplace_back(m_context, CL_MEM_READ_ONLY, ec.lightSize);
 
     //   OCL_CHECK(err, err = m_queue.enqueueMigrateMemObjects({m_lightCache},
     //                                                   0 /* 0 means from host*/));
 
     m_dagKernel.setArg(1, m_light[0]);
 
-    OCL_CHECK(err, err = m_queue.enqueueWriteBuffer(m_light[0], CL_TRUE, 0,
-                                                    m_epochContext.lightSize, m_epochContext.lightCache));
+    OCL_CHECK(err, err = queue.enqueueWriteBuffer(m_light[0], CL_TRUE, 0,
+                                                  ec.lightSize, ec.lightCache));
 
     // m_dagKernel.setArg(1, m_light[0]);
-    m_dagKernel.setArg(2, m_dag[0]);
-    m_dagKernel.setArg(3, m_dag[1]);
-    m_dagKernel.setArg(4, (uint32_t)(m_epochContext.lightSize / 64));
+    for (unsigned p = 0; p < m_settings.dagParts; p++)
+        m_dagKernel.setArg(2 + p, dag.buf[p]);
+    m_dagKernel.setArg(2 + m_settings.dagParts, (uint32_t)(ec.lightSize / 64));
+}
+
+// device timestamps of a finished command, false if they are not available
+static bool event_times(const cl::Event &ev, cl_ulong &queued, cl_ulong &start, cl_ulong &end)
+{
+    cl_int err[3];
 
-    const uint32_t workItems = m_epochContext.dagNumItems * 2; // GPU computes partial 512-bit DAG items.
+    queued = ev.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>(&err[0]);
+    start = ev.getProfilingInfo<CL_PROFILING_COMMAND_START>(&err[1]);
+    end = ev.getProfilingInfo<CL_PROFILING_COMMAND_END>(&err[2]);
+
+    return err[0] == CL_SUCCESS && err[1] == CL_SUCCESS && err[2] == CL_SUCCESS &&
+           queued <= start && start <= end;
+}
+
+void EthDevce::device_gen_dag(cl::CommandQueue &queue, uint32_t first, uint32_t last, DagSlot *dag, bool toCache)
+{
+    cl_int err;
+    struct Chunk
+    {
+        uint32_t start, end; // 512-bit work items
+        cl::Event knl;
+        cl::Event done; // the last read back, or the kernel
+        int64_t hostQueued;
+    };
+
+    const uint32_t lws = m_settings.localWorkSize;
+    const unsigned nparts = m_settings.dagParts;
+    // whole work-groups of whole items in every part, a chunk read back is
+    // one range of each part
+    const uint32_t step = lws * 2 * nparts;
+    uint32_t chunk = std::max(step, m_settings.dagChunkGroups * lws / step * step);
+    const uint32_t maxChunk = chunk * 16;
+    // tune() measures the chunk it sets
+    const bool adapt = !m_tuning;
+
+    // the items read back go to the file beside the next kernels
+    cl::CommandQueue readQueue;
+    if (toCache)
+    {
+        OCL_CHECK(err, readQueue = cl::CommandQueue(m_context, m_device, 0, &err));
+    }
+
+    first = first / step * step;
+    const auto t_build = steady_clock::now();
+    auto t_mark = t_build;
+    std::deque<Chunk> inFlight;
+
+    for (uint32_t start = first; start < last || !inFlight.empty();)
+    {
+        // chunks are independent, only their read back waits for them
+        if (start < last && inFlight.size() < c_dagChunksInFlight)
+        {
+            Chunk c;
+            c.start = start;
+            c.end = (uint32_t)std::min<uint64_t>(last, (uint64_t)start + chunk);
+            c.hostQueued = Tracer::on() ? Tracer::now() : 0;
+
+            const uint32_t groups = (c.end - c.start + lws - 1) / lws;
+            m_dagKernel.setArg(0, c.start);
+            OCL_CHECK(err, err = queue.enqueueNDRangeKernel(
+                                m_dagKernel, cl::NullRange, groups * lws, lws, nullptr, &c.knl));
+            c.done = c.knl;
+
+            if (toCache)
+            {
+                // item i goes to _DAG<i % nparts>
+                const uint32_t a = c.start / 2, b = c.end / 2;
+                const uint64_t offset = (uint64_t)a / nparts * 128;
+                const std::vector<cl::Event> deps{c.knl};
+                for (unsigned p = 0; p < nparts && a + p < b; p++)
+                {
+                    const uint64_t items = (b - a - p + nparts - 1) / nparts;
+                    OCL_CHECK(err, err = readQueue.enqueueReadBuffer(
+                                        dag->buf[p], CL_FALSE, offset, items * 128,
+                                        m_dagCache.part(p) + offset, &deps, &c.done));
+                }
+                readQueue.flush();
+            }
+            queue.flush();
+
+            inFlight.push_back(c);
+            start = c.end;
+            continue;
+        }
+
+        // the oldest chunk, the device has the next ones queued meanwhile
+        Chunk c = inFlight.front();
+        inFlight.pop_front();
+        c.done.wait();
+
+        cl_ulong queued, t0, t1;
+        const bool timed = event_times(c.knl, queued, t0, t1);
+        if (c.hostQueued)
+            trace_command(c.knl, "GenerateDAG", "kernel", c_traceDagTrack, c.hostQueued,
+                          "\"start\": " + std::to_string(c.start) + ", \"count\": " + std::to_string(c.end - c.start));
+        if (m_debug && timed)
+            printf("DAG: item %10u chunk %u, took %6.2fs\n", c.start, c.end - c.start, (t1 - t0) / 1e9);
+
+        // size the next chunks to c_dagChunkMs of device time, a tail chunk
+        // says little about that
+        if (adapt && timed && t1 > t0 && c.end < last)
+        {
+            const double scale = std::min(2.0, std::max(0.5, c_dagChunkMs * 1e6 / (t1 - t0)));
+            const uint64_t next = (uint64_t)((c.end - c.start) * scale) / step * step;
+            chunk = (uint32_t)std::min<uint64_t>(maxChunk, std::max<uint64_t>(step, next));
+        }
+
+        // chunks finish in order, [first, c.end) is complete
+        if (toCache && (c.end == last || steady_clock::now() - t_mark >= milliseconds(c_dagProgressMs)))
+        {
+            m_dagCache.mark_done(c.end / 2);
+            t_mark = steady_clock::now();
+        }
+        if (dag)
+            dag_progress(dag->ec.epochNumber, c.end / 2, last / 2, first / 2, t_build);
+    }
+}
+
+bool EthDevce::build_dag(unsigned slot, int epoch, cl::CommandQueue &queue)
+{
+    DagSlot &dag = m_dag[slot];
+    EpochContext &ec = dag.ec;
 
-    uint32_t start;
+    std::vector<uint64_t> partSize = alloc_dag(slot, epoch);
+
+    if (m_settings.lightSearch)
+    {
+        // search reads the light cache, only the cached items are generated
+        upload_light(slot, queue);
+        dag.light = m_light[0];
+        m_light.clear();
+
+        const uint32_t cached = partSize[0] / ethash::full_dataset_item_size;
+        printf("DAG: epoch %u lightSize %lu, light search with %u of %u items cached\n",
+               epoch, ec.lightSize, cached, ec.dagNumItems);
+        device_gen_dag(queue, 0, cached * 2, &dag);
+
+        release_light(ec);
+        dag.epoch = epoch;
+        return true;
+    }
+
+    if (m_dagCache.open(epoch, ec.dagNumItems, partSize))
+    {
+        std::cout << "DAG: loading " << m_dagCache.path(epoch, partSize.size()) << std::endl;
+        upload_dag(slot, queue);
+        m_dagCache.close();
+        dag.epoch = epoch;
+        return true;
+    }
+
+    if (m_settings.hostDag)
+    {
+        if (host_gen_dag(slot, queue, partSize))
+        {
+            release_light(ec);
+            dag.epoch = epoch;
+            return true;
+        }
+        std::cout << "DAG: host generation failed, using GenerateDAG" << std::endl;
+    }
+
+    // items are read back into the cache file as they are done, a build
+    // interrupted before goes on where it was recorded
+    uint32_t resumed = 0;
+    const bool toCache = m_dagCache.resume(epoch, ec.dagNumItems, partSize, resumed);
+    if (resumed)
+    {
+        std::cout << "DAG: resuming " << m_dagCache.path(epoch, partSize.size()) << " at item " << resumed << std::endl;
+        upload_dag(slot, queue, resumed);
+    }
+
+    upload_light(slot, queue);
 
     printf("DAG: epoch %u lightSize %lu dagSize %lu\n",
-            epoch, m_epochContext.lightSize, m_epochContext.dagSize);
+            epoch, ec.lightSize, ec.dagSize);
+
+    // GPU computes partial 512-bit DAG items.
+    device_gen_dag(queue, resumed * 2, ec.dagNumItems * 2, &dag, toCache);
+
+    // the device copy is all GenerateDAG needs from now on
+    m_light.clear();
+    release_light(ec);
+
+    if (toCache && m_dagCache.commit())
+        std::cout << "DAG: saved " << m_dagCache.path(epoch, partSize.size()) << std::endl;
+
+    dag.epoch = epoch;
+    return true;
+}
+
+bool EthDevce::host_gen_dag(unsigned slot, cl::CommandQueue &queue, const std::vector<uint64_t> &partSize)
+{
+    cl_int err;
+    HostDag gen(m_settings.hostDagThreads);
+    DagSlot &dag = m_dag[slot];
+    EpochContext &ec = dag.ec;
+
+    if (!ec.light)
+        get_context(ec.epochNumber, ec);
+
+    const uint32_t numItems = ec.dagNumItems;
+    const uint32_t chunk = c_hostDagChunk; // a multiple of every part count
+    const unsigned nparts = m_settings.dagParts;
+
+    printf("DAG: epoch %u lightSize %lu dagSize %lu, host %u threads %s\n",
+            ec.epochNumber, ec.lightSize, ec.dagSize, gen.threads(), gen.isa());
+
+    // generate straight into the cache file when it is kept, otherwise into
+    // two staging chunks so one is uploaded while the next one is computed.
+    // A file an interrupted build left goes on from its last whole chunk.
+    uint32_t resumed = 0;
+    const bool toCache = m_dagCache.resume(ec.epochNumber, numItems, partSize, resumed);
+    const uint32_t first = resumed / chunk * chunk;
+    if (first)
+    {
+        std::cout << "DAG: resuming " << m_dagCache.path(ec.epochNumber, partSize.size()) << " at item " << first << std::endl;
+        upload_dag(slot, queue, first);
+    }
+    std::vector<uint8_t> staging[2];
+    cl::Event written[2];
+    const auto t_build = steady_clock::now();
+    auto t_mark = t_build;
 
-    const uint32_t chunk = 10000 * m_settings.localWorkSize;
-    for (start = 0; start <= workItems - chunk; start += chunk)
+    for (uint32_t start = first, k = 0; start < numItems; start += chunk, k ^= 1)
     {
         auto t_start = high_resolution_clock::now();
+        const uint32_t end = std::min(numItems, start + chunk);
+        TraceScope trace("host DAG chunk", "dag");
+        if (trace.on())
+            trace.args = "\"start\": " + std::to_string(start) + ", \"count\": " + std::to_string(end - start);
+
+        const uint64_t offset = (uint64_t)start / nparts * 128;
+        std::vector<uint8_t *> parts(nparts);
+        if (toCache)
+        {
+            for (unsigned p = 0; p < nparts; p++)
+                parts[p] = m_dagCache.part(p) + offset;
+        }
+        else
+        {
+            if (written[k]())
+                written[k].wait();
+            staging[k].resize((uint64_t)chunk * 128);
+            for (unsigned p = 0; p < nparts; p++)
+                parts[p] = staging[k].data() + (uint64_t)chunk / nparts * 128 * p;
+        }
 
-        m_dagKernel.setArg(0, start);
-        m_queue.enqueueNDRangeKernel(
-            m_dagKernel, cl::NullRange, chunk, m_settings.localWorkSize);
-        m_queue.finish();
+        gen.generate(ec, start, end, parts.data(), nparts);
+
+        if (start == first && !gen.check(ec, start, end, parts.data(), nparts, 16))
+        {
+            queue.finish();
+            m_dagCache.close();
+            return false;
+        }
+
+        // item i goes to _DAG<i % nparts>, the last chunk may leave parts short
+        for (unsigned p = 0; p < nparts && start + p < end; p++)
+        {
+            const uint64_t items = (end - start - p + nparts - 1) / nparts;
+            OCL_CHECK(err, err = queue.enqueueWriteBuffer(
+                                dag.buf[p], CL_FALSE, offset, items * 128, parts[p],
+                                nullptr, &written[k]));
+        }
+        queue.flush();
+
+        // the file is written in order, [first, end) is complete
+        if (toCache && (end == numItems || steady_clock::now() - t_mark >= milliseconds(c_dagProgressMs)))
+        {
+            m_dagCache.mark_done(end);
+            t_mark = steady_clock::now();
+        }
+        dag_progress(ec.epochNumber, end, numItems, first, t_build);
 
         auto t_end = high_resolution_clock::now();
 
         auto duration = duration_cast<microseconds>(t_end - t_start);
         float ms = duration.count() / 1000;
         if (m_debug)
-            printf("DAG: item %10u chunk %u, took %6.2fs\n", start, chunk, ms/1000);
+            printf("DAG: item %10u chunk %u, took %6.2fs\n", start, end - start, ms/1000);
     }
+    queue.finish();
 
-    if (start < workItems)
-    {
-        uint32_t groupsLeft = workItems - start;
-        groupsLeft = (groupsLeft + m_settings.localWorkSize - 1) / m_settings.localWorkSize;
-        m_dagKernel.setArg(0, start);
-        m_queue.enqueueNDRangeKernel(m_dagKernel, cl::NullRange,
-                                        groupsLeft * m_settings.localWorkSize, m_settings.localWorkSize);
-        m_queue.finish();
-    }
+    if (toCache && m_dagCache.commit())
+        std::cout << "DAG: saved " << m_dagCache.path(ec.epochNumber, partSize.size()) << std::endl;
 
     return true;
 }
 
-float EthDevce::get_hashrate() noexcept
-{
-    // return m_hashRate.load(std::memory_order_relaxed);
-    return m_hashRate;
-}
-
-void EthDevce::update_hashrate(uint32_t _groupSize, uint32_t _increment) noexcept
+void EthDevce::upload_dag(unsigned slot, cl::CommandQueue &queue, uint32_t numItems)
 {
-    m_groupCount += _increment;
-    auto t = steady_clock::now();
-    auto us = duration_cast<microseconds>(t - m_hashTime).count();
-    m_hashTime = t;
+    TraceScope trace("upload DAG", "dag");
+    cl_int err;
+    const size_t chunk = c_dagCacheChunk;
+    DagSlot &dag = m_dag[slot];
+    const unsigned nparts = dag.buf.size();
 
-    // m_hashRate.store(
-    //     us ? (float(m_groupCount * _groupSize) * 1.0e6f) / us : 0.0f, std::memory_order_relaxed);
-    m_hashRate = us ? (float(m_groupCount * _groupSize)) / us : 0.0f;
-    m_groupCount = 0;
+    for (unsigned i = 0; i < nparts; i++)
+    {
+        const uint8_t *src = m_dagCache.part(i);
+        uint64_t size = m_dagCache.part_size(i);
+        if (numItems)
+            size = std::min<uint64_t>(size, (uint64_t)((numItems + nparts - 1 - i) / nparts) * 128);
+
+        // stream from the mapping, pages are faulted in while earlier
+        // chunks are already on their way to the device
+        for (uint64_t off = 0; off < size; off += chunk)
+        {
+            OCL_CHECK(err, err = queue.enqueueWriteBuffer(
+                                dag.buf[i], CL_FALSE, off,
+                                std::min<uint64_t>(chunk, size - off), src + off));
+        }
+    }
+    queue.finish();
 }
 
-ethash::search_result EthDevce::search(int start_nonce, ethash::hash256 &seed, ethash::hash256 &header, ethash::hash256 &boundary)
+bool EthDevce::setup_search(const ethash::hash256 &header, const ethash::hash256 &boundary,
+                            const ethash::hash256 *secondary)
 {
-    volatile SearchResults results = {0};
     cl_int err;
-    uint32_t zerox3[3] = {0, 0, 0};
-    ethash::search_result r = {};
 
     if (!m_knl_loaded)
     {
         std::cout << "Kernel is not loaded !!!" << std::endl;
-        return {};
+        return false;
+    }
+
+    if (m_dag[m_activeDag].epoch < 0)
+    {
+        std::cout << "DAG is not generated !!!" << std::endl;
+        return false;
     }
 
     const uint64_t target = get_target_value(boundary);
-    printf("Search: target 0x%lx\n", target);
+    // 0 only tags a hash of 0, which the primary target finds anyway
+    const uint64_t target2 = secondary ? get_target_value(*secondary) : 0;
+    if (m_debug)
+        printf("Search: target 0x%lx secondary 0x%lx\n", target, target2);
 
     // const uint64_t target = (uint64_t)(u64)((u256)boundary >> 192);  // edw. why ??
     assert(target > 0);
 
-    uint64_t startNonce = start_nonce;
+    const unsigned numBuffers = std::max(1u, m_settings.searchBuffers) * m_searchKernels.size();
 
-    m_header.clear();
-    m_header.push_back(cl::Buffer(m_context, CL_MEM_READ_ONLY, 32));
+    const cl_mem_flags hostFlags = m_settings.zeroCopy ? CL_MEM_ALLOC_HOST_PTR : 0;
 
-    m_searchBuffer.clear();
-    m_searchBuffer.emplace_back(m_context, CL_MEM_WRITE_ONLY, sizeof(SearchResults));
+    if (m_header.empty())
+        m_header.push_back(cl::Buffer(m_context, CL_MEM_READ_ONLY | hostFlags, 32));
+
+    // one result buffer per in-flight batch, searchBuffers for every instance
+    const size_t bufferSize = search_buffer_size(m_settings.groupResults, m_settings.globalWorkSizeMultiplier);
+    if (m_searchBuffer.size() != numBuffers || m_searchBufferSize != bufferSize)
+    {
+        release_search_buffers();
+
+        std::lock_guard<std::mutex> lock(m_searchLock);
+        for (unsigned i = 0; i < numBuffers; i++)
+            m_searchBuffer.emplace_back(m_context, CL_MEM_READ_WRITE | hostFlags, bufferSize);
+        m_searchBufferSize = bufferSize;
 
-    m_searchKernel.setArg(0, m_searchBuffer[0]); // Supply output buffer to kernel.
-    m_searchKernel.setArg(1, m_header[0]);       // Supply header buffer to kernel.
+        // only the SearchResults head, a work-group table is read when flagged
+        for (unsigned i = 0; i < numBuffers && m_settings.zeroCopy; i++)
+        {
+            void *host;
+            OCL_CHECK(err, host = m_queue.enqueueMapBuffer(m_searchBuffer[i], CL_TRUE, CL_MAP_READ | CL_MAP_WRITE,
+                                                           0, sizeof(SearchResults), nullptr, nullptr, &err));
+            m_searchMapped.push_back((SearchResults *)host);
+        }
+    }
+
+    // the arguments stay set between calls, only a new job rewrites them
+    if (m_searchTarget && target == m_searchTarget && target2 == m_searchTarget2 && memcmp(header.bytes, m_searchHeader.bytes, sizeof(header.bytes)) == 0)
+        return true;
+
+    for (auto &knl : m_searchKernels)
+        knl.setArg(1, m_header[0]);       // Supply header buffer to kernel.
 
     // Update header constant buffer.
-    OCL_CHECK(err, err = m_queue.enqueueWriteBuffer(
-                        m_header[0], CL_FALSE, 0, 32, header.bytes));
+    if (m_settings.zeroCopy)
+    {
+        void *host;
+        OCL_CHECK(err, host = m_queue.enqueueMapBuffer(m_header[0], CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION,
+                                                       0, 32, nullptr, nullptr, &err));
+        memcpy(host, header.bytes, 32);
+        OCL_CHECK(err, err = m_queue.enqueueUnmapMemObject(m_header[0], host, nullptr, &m_headerEvent));
+    }
+    else
+    {
+        OCL_CHECK(err, err = m_queue.enqueueWriteBuffer(
+                            m_header[0], CL_FALSE, 0, 32, header.bytes, nullptr, &m_headerEvent));
+    }
 
-    // m_searchKernel.setArg(0, m_searchBuffer[0]); // Supply output buffer to kernel.
-    // m_searchKernel.setArg(1, m_header[0]);       // Supply header buffer to kernel.
-    OCL_CHECK(err, m_searchKernel.setArg(2, m_dag[0])); // Supply DAG buffer to kernel.
-    OCL_CHECK(err, m_searchKernel.setArg(3, m_dag[1])); // Supply DAG buffer to kernel.
-    OCL_CHECK(err, m_searchKernel.setArg(4, m_epochContext.dagNumItems));
-    OCL_CHECK(err, m_searchKernel.setArg(6, target));
+    activate_dag(m_activeDag); // Supply DAG buffers to kernel.
+    for (auto &knl : m_searchKernels)
+    {
+        OCL_CHECK(err, knl.setArg(arg_target(), target));
+        OCL_CHECK(err, knl.setArg(arg_secondary_target(), target2));
+    }
+    m_searchHeader = header;
+    m_searchTarget = target;
+    m_searchTarget2 = target2;
 
     m_settings.globalWorkSize = m_settings.localWorkSize * m_settings.globalWorkSizeMultiplier;
 
-    do
+    return true;
+}
+
+void EthDevce::trace_command(const cl::Event &ev, const char *name, const char *cat, int tid, int64_t hostQueued,
+                             const std::string &args)
+{
+    cl_ulong queued, start, end;
+    if (!event_times(ev, queued, start, end))
+        return;
+
+    // the device stamps CL_PROFILING_COMMAND_QUEUED after hostQueued, so
+    // every command bounds the offset from below, keep the tightest bound
+    const int64_t bound = hostQueued - (int64_t)queued;
+    int64_t offset = m_traceOffset.load();
+    while (bound > offset && !m_traceOffset.compare_exchange_weak(offset, bound))
+        ;
+    offset = std::max(offset, bound);
+
+    Tracer::instance().complete(name, cat, trace_pid(), tid, (int64_t)start + offset, end - start, args);
+}
+
+void EthDevce::profile_batch(const cl::Event &zero, const cl::Event &knl, const cl::Event &read)
+{
+    cl_ulong queued, start, end;
+
+    if (event_times(knl, queued, start, end))
     {
-        // zero the result count
-        OCL_CHECK(err, err = m_queue.enqueueWriteBuffer(
-                            m_searchBuffer[0],
-                            CL_FALSE,                       // blocking_write
-                            offsetof(SearchResults, count), // offset
-                            sizeof(zerox3),                 // size
-                            zerox3));                       // data to be written
+        m_metrics.queued.record(start - queued);
+        m_metrics.kernel.record(end - start);
+    }
+    if (event_times(zero, queued, start, end))
+        m_metrics.transfer.record(end - start);
+    if (event_times(read, queued, start, end))
+        m_metrics.transfer.record(end - start);
+}
 
-        OCL_CHECK(err, m_searchKernel.setArg(5, startNonce));
-        OCL_CHECK(err, m_queue.enqueueNDRangeKernel(
-                            m_searchKernel, cl::NullRange, m_settings.globalWorkSize,
-                            m_settings.localWorkSize));
+void EthDevce::read_group_results(const cl::Buffer &buf, uint64_t batchNonce, std::vector<ethash::search_result> &sols,
+                                  std::vector<uint32_t> *targets)
+{
+    cl_int err;
+    const size_t groups = m_settings.globalWorkSizeMultiplier;
+    const size_t rsltOffset = sizeof(SearchResults) + groups * sizeof(uint32_t);
+
+    std::vector<uint32_t> groupCount(groups);
+    OCL_CHECK(err, err = m_queue.enqueueReadBuffer(
+                        buf, CL_TRUE, sizeof(SearchResults), groups * sizeof(uint32_t), groupCount.data()));
 
+    // hits are rare, fetch only the records of the groups that have some
+    SearchResult rslt[c_maxSearchResults];
+    for (size_t g = 0; g < groups; g++)
+    {
+        if (!groupCount[g])
+            continue;
+        if (groupCount[g] > c_maxSearchResults)
+            printf("Search: %u hits in group %zu of batch %lu, %zu kept\n",
+                   groupCount[g], g, batchNonce, c_maxSearchResults);
+
+        const uint32_t count = std::min<uint32_t>(groupCount[g], c_maxSearchResults);
         OCL_CHECK(err, err = m_queue.enqueueReadBuffer(
-                            m_searchBuffer[0],
-                            CL_TRUE,
-                            offsetof(SearchResults, count),
-                            // (m_settings.noExit ? 1 : 2) * sizeof(results.count),
-                            3 * sizeof(results.count), // read count, hashCount, abort
-                            (void *)&results.count));
+                            buf, CL_TRUE, rsltOffset + g * sizeof(rslt), count * sizeof(rslt[0]), rslt));
 
-        if (m_debug)
-            printf("Search: start nonce %12lu, hash count %u\n", startNonce, results.hashCount);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            ethash::search_result r;
+            r.solution_found = true;
+            r.nonce = batchNonce + rslt[i].gid;
+            memcpy(r.mix_hash.bytes, (char *)rslt[i].mix, sizeof(rslt[i].mix));
+            sols.push_back(r);
+            if (targets)
+                targets->push_back(rslt[i].targets);
+        }
+    }
+}
 
-        if (results.count > 0)
+uint64_t EthDevce::run_search(uint64_t startNonce, uint64_t count, bool firstOnly, std::vector<ethash::search_result> &sols,
+                              std::vector<uint32_t> *targets)
+{
+    cl_int err;
+    const uint32_t zerox3[3] = {0, 0, 0};
+    const unsigned numBuffers = m_searchBuffer.size();
+    const unsigned instances = m_searchKernels.size();
+    const uint64_t endNonce = (count > UINT64_MAX - startNonce) ? UINT64_MAX : startNonce + count;
+    uint64_t hashes = 0;
+    // batches are handled in order, the searched prefix ends at the first one
+    // an abort cut short
+    bool inOrder = true;
+    m_searched = 0;
+
+    // per batch: zero -> kernel -> read back, chained by events so the queue
+    // always holds the next batches while the host checks a finished one.
+    // Slot s always runs on instance s % K, consecutive batches on different
+    // instances, and only waits for its own previous read.
+    std::vector<SearchResults> results(numBuffers);
+    std::vector<uint64_t> batchNonce(numBuffers);
+    std::vector<cl::Event> zeroEvent(numBuffers), knlEvent(numBuffers), readEvent(numBuffers);
+    std::vector<int64_t> hostQueued(numBuffers, 0);
+    std::vector<bool> busy(numBuffers, false);
+
+    m_metrics.resume();
+
+    auto flush_all = [&]() {
+        for (auto &queue : m_searchQueues)
+            queue.flush();
+    };
+
+    auto enqueue_batch = [&](unsigned slot) {
+        cl::Kernel &knl = m_searchKernels[slot % instances];
+        cl::CommandQueue &queue = search_queue(slot % instances);
+        std::vector<cl::Event> zeroDeps{m_headerEvent};
+        hostQueued[slot] = Tracer::on() ? Tracer::now() : 0;
+        if (readEvent[slot]())
+            zeroDeps.push_back(readEvent[slot]);
+
+        // zero the result count
+        if (m_settings.zeroCopy)
+        {
+            // the host owns the slot between batches, clear it in place
+            SearchResults *host = m_searchMapped[slot];
+            memcpy(&host->count, zerox3, sizeof(zerox3));
+            OCL_CHECK(err, err = queue.enqueueUnmapMemObject(m_searchBuffer[slot], host, &zeroDeps, &zeroEvent[slot]));
+            m_searchMapped[slot] = nullptr;
+        }
+        else
         {
-            OCL_CHECK(err, err = m_queue.enqueueReadBuffer(
-                                m_searchBuffer[0],
-                                CL_TRUE,
-                                0,                                       // offset
-                                results.count * sizeof(results.rslt[0]), // size
-                                (void *)&results));
+            OCL_CHECK(err, err = queue.enqueueWriteBuffer(
+                                m_searchBuffer[slot],
+                                CL_FALSE,                       // blocking_write
+                                offsetof(SearchResults, count), // offset
+                                sizeof(zerox3),                 // size
+                                zerox3,                         // data to be written
+                                &zeroDeps, &zeroEvent[slot]));
+        }
 
-            printf("\nSearch: found, startNonce %lu, gid %u, hashCount %u abort %d\n",
-                    startNonce, results.rslt[0].gid,
-                    results.hashCount, results.abort);
-            break;
+        // arguments are captured at enqueue time
+        OCL_CHECK(err, knl.setArg(0, m_searchBuffer[slot])); // Supply output buffer to kernel.
+        OCL_CHECK(err, knl.setArg(arg_start_nonce(), startNonce));
+        std::vector<cl::Event> knlDeps{zeroEvent[slot]};
+        OCL_CHECK(err, err = queue.enqueueNDRangeKernel(
+                            knl, cl::NullRange, m_settings.globalWorkSize,
+                            m_settings.localWorkSize, &knlDeps, &knlEvent[slot]));
+
+        std::vector<cl::Event> readDeps{knlEvent[slot]};
+        if (m_settings.zeroCopy)
+        {
+            // back to the host, read in place once readEvent completes
+            void *host;
+            OCL_CHECK(err, host = queue.enqueueMapBuffer(m_searchBuffer[slot], CL_FALSE, CL_MAP_READ | CL_MAP_WRITE,
+                                                         0, sizeof(SearchResults), &readDeps, &readEvent[slot], &err));
+            m_searchMapped[slot] = (SearchResults *)host;
+        }
+        else
+        {
+            OCL_CHECK(err, err = queue.enqueueReadBuffer(
+                                m_searchBuffer[slot],
+                                CL_FALSE,
+                                offsetof(SearchResults, count),
+                                3 * sizeof(results[slot].count), // read count, hashCount, abort
+                                (void *)&results[slot].count,
+                                &readDeps, &readEvent[slot]));
         }
+
+        batchNonce[slot] = startNonce;
+        busy[slot] = true;
         startNonce += m_settings.globalWorkSize;
+    };
+
+    for (unsigned slot = 0; slot < numBuffers && startNonce < endNonce && !m_abort; slot++)
+        enqueue_batch(slot);
+    flush_all();
+    if (busy[0])
+        m_metrics.job_started();
+
+    // handled in submission order, with several instances a later batch may
+    // finish first and waits for its turn while the others keep running
+    for (unsigned slot = 0; busy[slot]; slot = (slot + 1) % numBuffers)
+    {
+        OCL_CHECK(err, err = readEvent[slot].wait());
+        SearchResults &res = results[slot];
+        if (m_settings.zeroCopy)
+            memcpy(&res.count, &m_searchMapped[slot]->count, 3 * sizeof(res.count));
+        busy[slot] = false;
+        profile_batch(zeroEvent[slot], knlEvent[slot], readEvent[slot]);
+        if (hostQueued[slot])
+        {
+            const std::string args = "\"nonce\": " + std::to_string(batchNonce[slot]);
+            const int tid = slot % instances;
+            trace_command(zeroEvent[slot], m_settings.zeroCopy ? "unmap results" : "zero results", "transfer", tid, hostQueued[slot], args);
+            trace_command(knlEvent[slot], "search", "kernel", tid, hostQueued[slot], args);
+            trace_command(readEvent[slot], m_settings.zeroCopy ? "map results" : "read results", "transfer", tid, hostQueued[slot], args);
+        }
+
+        if (m_debug)
+            printf("Search: start nonce %12lu, hash count %u\n", batchNonce[slot], res.hashCount);
 
         if (m_settings.noExit)
+        {
             update_hashrate(m_settings.globalWorkSize, 1);
+            hashes += m_settings.globalWorkSize;
+        }
+        else
+        {
+            update_hashrate(m_settings.localWorkSize, res.hashCount);
+            hashes += (uint64_t)m_settings.localWorkSize * res.hashCount;
+        }
+        // with FAST_EXIT the groups that saw the abort flag counted nothing,
+        // which ones is unknown
+        inOrder = inOrder && (m_settings.noExit || (uint64_t)m_settings.localWorkSize * res.hashCount == m_settings.globalWorkSize);
+        if (inOrder)
+            m_searched += m_settings.globalWorkSize;
+
+        if (res.count > 0)
+        {
+            const size_t first = sols.size();
+
+            if (m_settings.groupResults)
+                read_group_results(m_searchBuffer[slot], batchNonce[slot], sols, targets);
+            else
+            {
+                if (res.count > c_maxSearchResults)
+                    printf("Search: %u hits in batch %lu, %zu kept\n", res.count, batchNonce[slot], c_maxSearchResults);
+
+                const uint32_t count = std::min<uint32_t>(res.count, c_maxSearchResults);
+                if (m_settings.zeroCopy)
+                    memcpy(res.rslt, m_searchMapped[slot]->rslt, count * sizeof(res.rslt[0]));
+                else
+                {
+                    OCL_CHECK(err, err = m_queue.enqueueReadBuffer(
+                                        m_searchBuffer[slot],
+                                        CL_TRUE,
+                                        0,                                  // offset
+                                        count * sizeof(res.rslt[0]),        // size
+                                        (void *)&res));
+                }
+
+                for (uint32_t i = 0; i < count; i++)
+                {
+                    ethash::search_result r;
+                    r.solution_found = true;
+                    r.nonce = batchNonce[slot] + res.rslt[i].gid;
+                    memcpy(r.mix_hash.bytes, (char *)res.rslt[i].mix, sizeof(res.rslt[i].mix));
+                    sols.push_back(r);
+                    if (targets)
+                        targets->push_back(res.rslt[i].targets);
+                }
+            }
+            m_metrics.add_solutions(sols.size() - first);
+
+            if (m_debug)
+                printf("\nSearch: found %zu, startNonce %lu, hashCount %u abort %d\n",
+                        sols.size() - first, batchNonce[slot], res.hashCount, res.abort);
+
+            if (firstOnly)
+                break;
+        }
+
+        // aborted, let the batches in flight drain
+        if (startNonce < endNonce && !m_abort)
+        {
+            enqueue_batch(slot);
+            flush_all();
+        }
+    }
+
+    // drain the batches still in flight, the buffers are reused by the next call
+    for (auto &queue : m_searchQueues)
+        queue.finish();
+
+    return hashes;
+}
+
+void EthDevce::release_search_buffers()
+{
+    std::lock_guard<std::mutex> lock(m_searchLock);
+
+    // a buffer is released mapped otherwise
+    for (size_t i = 0; i < m_searchMapped.size(); i++)
+    {
+        if (m_searchMapped[i])
+            m_queue.enqueueUnmapMemObject(m_searchBuffer[i], m_searchMapped[i]);
+    }
+    if (!m_searchMapped.empty())
+        m_queue.finish();
+
+    m_searchMapped.clear();
+    m_searchBuffer.clear();
+}
+
+void EthDevce::abort()
+{
+    EthBackend::abort();
+
+    // without FAST_EXIT the kernel never reads the flag
+    if (!m_knl_loaded || m_settings.noExit)
+        return;
+
+    // the zero write of each batch clears it again for the next job
+    static const uint32_t one = 1;
+    std::lock_guard<std::mutex> lock(m_searchLock);
+    for (auto &buf : m_searchBuffer)
+        m_abortQueue.enqueueWriteBuffer(buf, CL_FALSE, offsetof(SearchResults, abort), sizeof(one), &one);
+    m_abortQueue.finish();
+}
+
+std::vector<ethash::search_result> EthDevce::search(uint64_t start_nonce, ethash::hash256 &seed, ethash::hash256 &header, ethash::hash256 &boundary)
+{
+    std::vector<ethash::search_result> sols;
+
+    if (!setup_search(header, boundary))
+        return {};
+
+    printf("Search: target 0x%lx\n", get_target_value(boundary));
+    run_search(start_nonce, UINT64_MAX, true, sols);
+
+    // every hit of the batch, a kernel fault must not pass as a share
+    verify_solutions(header, boundary, sols);
+    return sols;
+}
+
+uint64_t EthDevce::batch_size() const
+{
+    return (uint64_t)m_settings.localWorkSize * m_settings.globalWorkSizeMultiplier;
+}
+
+uint64_t EthDevce::scan(uint64_t start_nonce, uint64_t count, const ethash::hash256 &header, const ethash::hash256 &boundary, std::vector<ethash::search_result> &sols)
+{
+    m_searched = 0;
+    if (!setup_search(header, boundary))
+        return 0;
+
+    return run_search(start_nonce, count, false, sols);
+}
+
+std::vector<ethash::search_result> EthDevce::search(uint64_t start_nonce, const ethash::hash256 &header,
+                                                    const ethash::hash256 &boundary, const ethash::hash256 &secondary,
+                                                    std::vector<uint32_t> &targets)
+{
+    std::vector<ethash::search_result> sols;
+    targets.clear();
+
+    if (!setup_search(header, boundary, &secondary))
+        return {};
+
+    printf("Search: target 0x%lx secondary 0x%lx\n", get_target_value(boundary), get_target_value(secondary));
+    run_search(start_nonce, UINT64_MAX, true, sols, &targets);
+
+    // each target a hit claims is verified on its own, a kernel fault must
+    // pass neither as a share nor as a block
+    size_t kept = 0;
+    for (size_t i = 0; i < sols.size(); i++)
+    {
+        const ethash::search_result &r = sols[i];
+        uint32_t met = 0;
+        if ((targets[i] & c_primaryTarget) && verify(header, r.mix_hash, r.nonce, boundary))
+            met |= c_primaryTarget;
+        if ((targets[i] & c_secondaryTarget) && verify(header, r.mix_hash, r.nonce, secondary))
+            met |= c_secondaryTarget;
+        if (met != targets[i])
+            printf("Search: nonce %lu targets %u rejected by verify\n", r.nonce, targets[i] & ~met);
+        if (!met)
+            continue;
+
+        if (met & c_secondaryTarget)
+            printf("Search: nonce %lu is a block candidate\n", r.nonce);
+        sols[kept] = r;
+        targets[kept] = met;
+        kept++;
+    }
+    sols.resize(kept);
+    targets.resize(kept);
+    return sols;
+}
+
+uint64_t EthDevce::scan(uint64_t start_nonce, uint64_t count, const ethash::hash256 &header, const ethash::hash256 &boundary,
+                        const ethash::hash256 &secondary, std::vector<ethash::search_result> &sols, std::vector<uint32_t> &targets)
+{
+    m_searched = 0;
+    if (!setup_search(header, boundary, &secondary))
+        return 0;
+
+    return run_search(start_nonce, count, false, sols, &targets);
+}
+
+std::string EthDevce::tune_key()
+{
+    // the definitions that change the kernel, see load_kernel
+    char build[64];
+    snprintf(build, sizeof(build), "p%u l%u i%u x%u", m_settings.dagParts, m_settings.lightSearch ? 1 : 0,
+             m_settings.searchInstances, m_settings.noExit ? 0 : 1);
+    return TuneStore::key(m_device.getInfo<CL_DEVICE_NAME>(), m_device.getInfo<CL_DRIVER_VERSION>(),
+                          m_knl_file, build);
+}
+
+double EthDevce::tune_search(double seconds)
+{
+    // target 1, nothing is found and every batch runs to the end
+    ethash::hash256 boundary = {};
+    boundary.bytes[7] = 1;
+    const ethash::hash256 header = {};
+    std::vector<ethash::search_result> sols;
+
+    if (!setup_search(header, boundary))
+        return 0;
+
+    const uint64_t count = batch_size() * m_settings.searchBuffers * m_settings.searchInstances;
+    run_search(0, count, false, sols); // warm up
+
+    uint64_t hashes = 0;
+    auto t_start = high_resolution_clock::now();
+    do
+    {
+        hashes += run_search(hashes + count, count, false, sols);
+    } while (duration_cast<milliseconds>(high_resolution_clock::now() - t_start).count() < seconds * 1000);
+
+    auto us = duration_cast<microseconds>(high_resolution_clock::now() - t_start).count();
+    return us ? double(hashes) / us : 0;
+}
+
+bool EthDevce::tune(int epoch)
+{
+    if (!m_knl_loaded)
+    {
+        std::cout << "Kernel is not loaded !!!" << std::endl;
+        return false;
+    }
+
+    const std::string key = tune_key();
+    const size_t maxGroup = m_device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+
+    std::vector<unsigned> lwsList;
+    if (m_binary)
+        lwsList.push_back(m_settings.localWorkSize); // fixed by the xclbin
+    else
+    {
+        for (unsigned lws = 32; lws <= std::min<size_t>(maxGroup, 1024); lws *= 2)
+            lwsList.push_back(lws);
+    }
+    const unsigned multList[] = {1024, 4096, 16384, 65536};
+    const unsigned chunkList[] = {1000, 5000, 10000, 20000};
+
+    // a slice of the DAG is enough, search reads whatever the rest holds
+    EpochContext ec;
+    get_context(epoch, ec);
+    const uint32_t workItems = std::min<uint32_t>(c_tuneDagItems, ec.dagNumItems) * 2;
+
+    const CLSettings saved = m_settings;
+    TuneProfile best;
+    m_tuning = true;
+
+    printf("TUNE: %s, max work-group size %zu\n", key.c_str(), maxGroup);
+
+    for (unsigned lws : lwsList)
+    {
+        m_settings.localWorkSize = lws;
+        if (!load_kernel())
+            continue;
+
+        const size_t knlGroup = m_searchKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(m_device);
+        if (lws > knlGroup)
+        {
+            printf("TUNE: lws %4u above kernel limit %zu\n", lws, knlGroup);
+            continue;
+        }
+
+        if (m_settings.lightSearch)
+            build_dag(0, epoch, m_queue); // every item comes from the light cache anyway
         else
-            update_hashrate(m_settings.localWorkSize, results.hashCount);
+        {
+            alloc_dag(0, epoch);
+            upload_light(0, m_queue);
+            device_gen_dag(m_queue, 0, workItems);
+        }
+        m_dag[0].epoch = epoch;
+        m_activeDag = 0;
 
-    } while (results.count == 0);
+        for (unsigned mult : multList)
+        {
+            m_settings.globalWorkSizeMultiplier = mult;
+            const double rate = tune_search(1.0);
+
+            printf("TUNE: lws %4u mult %6u %8.2f Mh\n", lws, mult, rate);
+            if (rate > best.hashRate)
+            {
+                best.localWorkSize = lws;
+                best.globalWorkSizeMultiplier = mult;
+                best.hashRate = rate;
+            }
+        }
+    }
 
-    if (results.count > 0)
+    if (best.hashRate > 0)
     {
-        r.solution_found = true;
-        r.nonce = startNonce + results.rslt[0].gid;
-        memcpy(r.mix_hash.bytes, (char *)results.rslt[0].mix, sizeof(results.rslt[0].mix));
+        // DAG chunk at the chosen work-group size
+        m_settings.localWorkSize = best.localWorkSize;
+        if (load_kernel())
+        {
+            alloc_dag(0, epoch);
+            upload_light(0, m_queue);
+
+            for (unsigned groups : chunkList)
+            {
+                m_settings.dagChunkGroups = groups;
+
+                auto t_start = high_resolution_clock::now();
+                device_gen_dag(m_queue, 0, workItems);
+                auto us = duration_cast<microseconds>(high_resolution_clock::now() - t_start).count();
+                const double rate = us ? (workItems / 2) * 1e6 / us : 0;
+
+                printf("TUNE: dag chunk %6u groups %12.0f items/s\n", groups, rate);
+                if (rate > best.dagRate)
+                {
+                    best.dagChunkGroups = groups;
+                    best.dagRate = rate;
+                }
+            }
+        }
     }
 
-    return r;
-}
\ No newline at end of file
+    m_tuning = false;
+    m_settings = saved;
+
+    if (best.hashRate <= 0 || best.dagRate <= 0)
+    {
+        std::cout << "TUNE: no working configuration found" << std::endl;
+        load_kernel();
+        return false;
+    }
+
+    printf("TUNE: best lws %u mult %u dag chunk %u groups, %.2f Mh\n",
+           best.localWorkSize, best.globalWorkSizeMultiplier, best.dagChunkGroups, best.hashRate);
+    if (m_tuneStore.save(key, best))
+        std::cout << "TUNE: saved to " << m_tuneStore.path() << std::endl;
+
+    // reload with the new profile, the DAG has to be generated again
+    if (!m_tuneStore.enabled())
+    {
+        if (!m_binary)
+            m_settings.localWorkSize = best.localWorkSize;
+        m_settings.globalWorkSizeMultiplier = best.globalWorkSizeMultiplier;
+        m_settings.dagChunkGroups = best.dagChunkGroups;
+    }
+    return load_kernel();
+}
@@ -1,43 +1,15 @@
 #ifndef _XLETH_H
 #define _XLETH_H
 
-#include <assert.h> /* assert */
+#include <deque>
+#include <mutex>
 
-#include <fstream>
-#include <iostream>
-#include <vector>
-#include <chrono>
-#include <algorithm>
-#include <atomic> 
-#include <memory.h>
-
-#include <ethash/ethash.hpp>
-#include <test/unittests/helpers.hpp>
-
-using namespace std;
-using namespace std::chrono;
-
-//------------------------------------------------------------------------------
-// ethash
-//------------------------------------------------------------------------------
-// diff = '0x{:064x}'.format((int(2**256/DIFFICULTY)))
-//DIFFICULTY = 100000000 
-#define DIF_100M "0x0000002af31dc4611873bf3f70834acdae9f0f4f534f5d60585a5f1c1a3ced1b"
-//DIFFICULTY = 200000000 
-#define DIF_200M "0x00000015798ee2308c39df9fb841a566d74f87a7a9a7aeb02c2d2f8e0d1e768d"
-//DIFFICULTY = 500000000 
-#define DIF_500M "0x000000089705f4136b4a59731680a88f8953030fdd7645e011abac9f387295d2"
-
-struct EpochContext
-{
-    // ethash::epoch_context m_ec;
-    int epochNumber;
-    int lightNumItems;
-    size_t lightSize;
-    const ethash_hash512 *lightCache;
-    int dagNumItems;
-    uint64_t dagSize;
-};
+#include "backend.hpp"
+#include "dagcache.hpp"
+#include "hostdag.hpp"
+#include "tuner.hpp"
+#include "progcache.hpp"
+#include "trace.hpp"
 
 struct CLSettings
 {
@@ -46,27 +18,63 @@ struct CLSettings
     bool noExit = true; // note, noExit for AMD should be false, but here we set it true
     unsigned localWorkSize = 128;
     unsigned globalWorkSizeMultiplier = 65536;
+    unsigned searchBuffers = 3; // search batches in flight
+    unsigned dagChunkGroups = 10000; // GenerateDAG work-groups per launch
+    bool hostDag = false;       // generate the DAG on the host instead of GenerateDAG
+    unsigned hostDagThreads = 0;
+    bool groupResults = false;  // kernel keeps hits per work-group (XILINX)
+    unsigned dagParts = 2;      // DAG buffers, DAG_PARTS of the kernel
+    bool bankPlacement = false; // place each DAG part in the bank of its kernel argument (XRT)
+    unsigned searchInstances = 1; // search kernels launched side by side, compute units on Xilinx
+    bool instanceQueues = false;  // one in-order queue per instance instead of one out-of-order queue
+    bool zeroCopy = false;        // header and results in host memory, mapped instead of copied
+    bool lightSearch = false;     // compute the DAG items from the light cache (LIGHT_SEARCH)
+    uint32_t cachedItems = 0;     // light search: the first DAG items generated and kept on the device
     // computed
     unsigned globalWorkSize = 0;
 };
 
 const size_t c_maxSearchResults = 4;
+const size_t c_dagCacheChunk = 64 * 1024 * 1024; // bytes per DAG upload write
+const uint32_t c_hostDagChunk = 1 << 18;           // DAG items per host generated chunk
+const uint32_t c_tuneDagItems = 1 << 20;           // DAG items generated per tuning run
+const unsigned c_dagChunkMs = 250;                 // GenerateDAG chunk latency adapted to
+const unsigned c_dagChunksInFlight = 3;            // GenerateDAG chunks queued at once
+
+struct SearchResult
+{
+    uint32_t gid;
+    // Can't use h256 data type here since h256 contains
+    // more than raw data. Kernel returns raw mix hash.
+    uint32_t mix[8];
+    uint32_t targets; // c_primaryTarget | c_secondaryTarget the hit meets
+    uint32_t pad[6]; // pad to 16 words for easy indexing
+};
+
+// targets a hit of a dual-target search meets
+const uint32_t c_primaryTarget = 1;   // pool shares
+const uint32_t c_secondaryTarget = 2; // block candidates
 
 struct SearchResults
 {
-    struct
-    {
-        uint32_t gid;
-        // Can't use h256 data type here since h256 contains
-        // more than raw data. Kernel returns raw mix hash.
-        uint32_t mix[8];
-        uint32_t pad[7]; // pad to 16 words for easy indexing
-    } rslt[c_maxSearchResults];
+    SearchResult rslt[c_maxSearchResults];
     uint32_t count;
     uint32_t hashCount;
     uint32_t abort;
 };
 
+// Kernels built with XILINX have no atomics and keep up to
+// c_maxSearchResults hits per work-group behind SearchResults:
+//   uint32_t groupCount[groups];
+//   SearchResult groupRslt[groups][c_maxSearchResults];
+// count is only a flag that some groupCount is not zero.
+inline size_t search_buffer_size(bool groupResults, size_t groups)
+{
+    if (!groupResults)
+        return sizeof(SearchResults);
+    return sizeof(SearchResults) + groups * (sizeof(uint32_t) + c_maxSearchResults * sizeof(SearchResult));
+}
+
 //------------------------------------------------------------------------------
 // OpenCL
 //------------------------------------------------------------------------------
@@ -77,6 +85,7 @@ struct SearchResults
 #define CL_USE_DEPRECATED_OPENCL_1_2_APIS
 
 #include <CL/cl2.hpp>
+#include <CL/cl_ext_xilinx.h>
 
 #define OCL_CHECK(error, call)                                                 \
     call;                                                                      \
@@ -87,13 +96,22 @@ struct SearchResults
         exit(EXIT_FAILURE);                                                    \
     }
 
-class EthDevce
+struct DagSlot
+{
+    int epoch = -1;                 // epoch held, -1 while empty or being built
+    struct EpochContext ec = {};
+    std::vector<cl::Buffer> buf;    // _DAG0 .. _DAG<parts - 1>
+    std::vector<uint64_t> capacity; // allocated bytes of each buffer
+    cl::Buffer light;               // light search: the light cache, kept as long as the slot
+};
+
+class EthDevce : public EthBackend
 {
 protected:
     // opencl
     char *m_platform_name;
     char *m_knl_file;
-    bool m_debug;
+    unsigned m_deviceIndex = 0;
     vector<std::string> m_definitions;
     std::string m_code;
     bool m_binary; // binary kernel
@@ -101,24 +119,83 @@ protected:
     CLSettings m_settings;
 
     cl::CommandQueue m_queue;
+    cl::CommandQueue m_dagQueue;
+    cl::CommandQueue m_abortQueue; // raises the abort flag of running batches
     cl::Context m_context;
     cl::Device m_device;
     cl::Program m_program;
     cl::Kernel m_dagKernel;
-    cl::Kernel m_searchKernel;
-    std::vector<cl::Buffer> m_dag;
+    cl::Kernel m_searchKernel; // instance 0
+    // every instance has its own arguments and batches, batch b runs on
+    // instance b % K so the instances search interleaved nonce ranges
+    std::vector<cl::Kernel> m_searchKernels;
+    std::vector<cl::CommandQueue> m_searchQueues; // one shared, or one per instance
+    // active DAG and the spare one the next epoch is built into
+    DagSlot m_dag[2];
+    unsigned m_activeDag = 0;
+    std::thread m_dagThread;
+    std::atomic<bool> m_dagReady{true};
     std::vector<cl::Buffer> m_light;
     std::vector<cl::Buffer> m_header;
     std::vector<cl::Buffer> m_searchBuffer;
+    size_t m_searchBufferSize = 0;
+    std::mutex m_searchLock; // m_searchBuffer against abort() of other threads
+    // zero copy: host view of every result buffer, mapped between its batches
+    std::vector<SearchResults *> m_searchMapped;
+    cl::Event m_headerEvent;
+    // job the search arguments hold, a repeated scan() writes nothing
+    ethash::hash256 m_searchHeader = {};
+    uint64_t m_searchTarget = 0;
+    uint64_t m_searchTarget2 = 0;
 
-    // hash rate
-    std::chrono::steady_clock::time_point m_hashTime = std::chrono::steady_clock::now();
-    // std::atomic<float> m_hashRate{0.0} ;
-    float m_hashRate;
-    uint64_t m_groupCount = 0;
+    DagCache m_dagCache;
+    TuneStore m_tuneStore;
+    ProgramCache m_programCache;
+    bool m_tuning = false; // tune() drives the settings, ignore saved profiles
+    // host steady clock minus device clock, the largest lower bound seen
+    std::atomic<int64_t> m_traceOffset{INT64_MIN};
 
-    // ethash
-    struct EpochContext m_epochContext;
+    cl::CommandQueue &search_queue(unsigned instance) { return m_searchQueues[instance % m_searchQueues.size()]; }
+    // the search arguments behind the DAG parts move with their count
+    unsigned arg_dag_size() const { return 2 + m_settings.dagParts; }
+    unsigned arg_start_nonce() const { return 3 + m_settings.dagParts; }
+    unsigned arg_target() const { return 4 + m_settings.dagParts; }
+    unsigned arg_secondary_target() const { return 5 + m_settings.dagParts; }
+    // light search: light cache, its size in nodes and the cached item count
+    unsigned arg_light() const { return 6 + m_settings.dagParts; }
+
+    void create_search_instances();
+    void release_search_buffers();
+    // without a secondary boundary only the primary one finds hits
+    bool setup_search(const ethash::hash256 &header, const ethash::hash256 &boundary,
+                      const ethash::hash256 *secondary = nullptr);
+    // with targets, the targets of every hit are appended beside it
+    uint64_t run_search(uint64_t startNonce, uint64_t count, bool firstOnly, std::vector<ethash::search_result> &sols,
+                        std::vector<uint32_t> *targets = nullptr);
+    void profile_batch(const cl::Event &zero, const cl::Event &knl, const cl::Event &read);
+    int trace_pid() const { return 1 + m_deviceIndex; }
+    // put a finished command on a device track, hostQueued is the host clock
+    // taken right before it was enqueued
+    void trace_command(const cl::Event &ev, const char *name, const char *cat, int tid, int64_t hostQueued,
+                       const std::string &args = "");
+    // hits of the work-group table of a flagged batch
+    void read_group_results(const cl::Buffer &buf, uint64_t batchNonce, std::vector<ethash::search_result> &sols,
+                            std::vector<uint32_t> *targets);
+    bool build_dag(unsigned slot, int epoch, cl::CommandQueue &queue);
+    std::vector<uint64_t> alloc_dag(unsigned slot, int epoch);
+    void upload_light(unsigned slot, cl::CommandQueue &queue);
+    // Run GenerateDAG over the 512-bit work items [first, last), a few chunks
+    // in flight and sized to c_dagChunkMs. With dag, report progress of its
+    // epoch, with toCache, read every chunk back into the open DAG cache file
+    // and record the items complete there.
+    void device_gen_dag(cl::CommandQueue &queue, uint32_t first, uint32_t last, DagSlot *dag = nullptr,
+                        bool toCache = false);
+    // Mh of the loaded kernel over the DAG in slot 0
+    double tune_search(double seconds);
+    void activate_dag(unsigned slot);
+    bool host_gen_dag(unsigned slot, cl::CommandQueue &queue, const std::vector<uint64_t> &partSize);
+    // the open DAG cache file, or its first numItems items
+    void upload_dag(unsigned slot, cl::CommandQueue &queue, uint32_t numItems = 0);
 
 public:
     EthDevce() {}
@@ -128,30 +205,111 @@ public:
         m_knl_file = knl_file;
         m_binary = bBinary; // binary kernel
         m_debug = debug;
+        // the xclbin is built with XILINX, see Makefile
+        m_settings.groupResults = !strcmp(platform_name, "Xilinx");
+        m_settings.bankPlacement = !strcmp(platform_name, "Xilinx");
+    }
+    ~EthDevce()
+    {
+        if (m_dagThread.joinable())
+            m_dagThread.join();
     }
     bool set_params(unsigned localWorkSize, unsigned globalWorkSizeMultiplier, bool noExit) 
     {
         m_settings.localWorkSize = localWorkSize;
         m_settings.globalWorkSizeMultiplier = globalWorkSizeMultiplier;
         m_settings.noExit = noExit;
+        return true;
+    }
+    void set_dag_chunk(unsigned groups)
+    {
+        m_settings.dagChunkGroups = std::max(1u, groups);
+    }
+    // 1, 2, 4 or 8, an xclbin has the DAG_PARTS it was built with
+    bool set_dag_parts(unsigned parts)
+    {
+        if (parts != 1 && parts != 2 && parts != 4 && parts != 8)
+            return false;
+        m_settings.dagParts = parts;
+        return true;
+    }
+    // K search kernels in flight at once, on one out-of-order queue unless
+    // the device has none or multiQueue asks for a queue per instance
+    void set_instances(unsigned instances, bool multiQueue = false)
+    {
+        m_settings.searchInstances = std::max(1u, instances);
+        m_settings.instanceQueues = multiQueue;
+    }
+    // Header and SearchResults in CL_MEM_ALLOC_HOST_PTR memory, handed over by
+    // unmap/map instead of a write and a read per batch. Both are free on
+    // devices sharing host memory (APUs, CPU platforms).
+    void set_zero_copy(bool enable)
+    {
+        m_settings.zeroCopy = enable;
+    }
+    // Search without the DAG: LIGHT_SEARCH kernels compute every item from
+    // the light cache, except the first cacheBytes of the DAG which are
+    // generated and kept on the device. The DAG is one buffer then.
+    void set_light_search(bool enable, uint64_t cacheBytes = 0)
+    {
+        m_settings.lightSearch = enable;
+        m_settings.cachedItems = (uint32_t)std::min<uint64_t>(cacheBytes / ethash::full_dataset_item_size, UINT32_MAX);
+    }
+    void set_device(unsigned index)
+    {
+        m_deviceIndex = index;
+    }
+    void set_host_dag(bool enable, unsigned threads = 0)
+    {
+        m_settings.hostDag = enable;
+        m_settings.hostDagThreads = threads;
+    }
+    void set_dag_cache(const char *dir)
+    {
+        m_dagCache.set_dir(dir ? dir : "");
+    }
+    void set_program_cache(const char *dir)
+    {
+        m_programCache.set_dir(dir ? dir : "");
+    }
+    void set_tune_file(const char *path)
+    {
+        m_tuneStore.set_path(path ? path : "");
     }
     vector<unsigned char> read_binary_file(const char *xclbin_file_name);
     vector<cl::Device> get_devices(const string &platform_name);
     void add_definition(char const *_id, unsigned _value);
-    bool load_kernel();
-    bool get_context(int epoch);
-    void disp_device();
-    bool gen_dag(int epoch);
-    ethash::search_result search(int start_nonce, ethash::hash256 &seed, ethash::hash256 &header, ethash::hash256 &boundary);
-    bool verify(ethash::hash256 &header, ethash::hash256& mix_hash, uint64_t nonce, ethash::hash256 &boundary)
-    {
-        ethash::epoch_context _ec = ethash::get_global_epoch_context(m_epochContext.epochNumber);
-        return ethash::verify(_ec, header, mix_hash, nonce, boundary);
-    }
-    float get_hashrate() noexcept;
-    void update_hashrate(uint32_t _groupSize, uint32_t _increment) noexcept;
+    const char *name() const override { return "OpenCL"; }
+    bool load_kernel() override;
+    void disp_device() override;
+    bool gen_dag(int epoch) override;
+    // Sweep work-group size and multiplier for hash rate, then the DAG chunk
+    // for GenerateDAG throughput, save the best as this device's profile and
+    // reload with it. The DAG has to be generated afterwards.
+    bool tune(int epoch);
+    std::string tune_key();
+    // build the DAG of an epoch into the spare slot while search goes on
+    bool prepare_dag(int epoch);
+    // Make a prepared epoch active, only search arguments 2-4 change. Called
+    // between jobs, Session::set_job() switches before the first launch on a
+    // header of the new epoch.
+    bool switch_dag(int epoch) override;
+    std::vector<ethash::search_result> search(uint64_t start_nonce, ethash::hash256 &seed, ethash::hash256 &header, ethash::hash256 &boundary) override;
+    uint64_t batch_size() const override;
+    uint64_t scan(uint64_t start_nonce, uint64_t count, const ethash::hash256 &header, const ethash::hash256 &boundary, std::vector<ethash::search_result> &sols) override;
+    // Dual-target search: one pass finds the hits of the primary (share) and
+    // the secondary (block) boundary, targets[i] holds the c_primaryTarget and
+    // c_secondaryTarget bits sols[i] meets. search() verifies every bit and
+    // drops the ones that fail.
+    std::vector<ethash::search_result> search(uint64_t start_nonce, const ethash::hash256 &header,
+                                              const ethash::hash256 &boundary, const ethash::hash256 &secondary,
+                                              std::vector<uint32_t> &targets);
+    uint64_t scan(uint64_t start_nonce, uint64_t count, const ethash::hash256 &header, const ethash::hash256 &boundary,
+                  const ethash::hash256 &secondary, std::vector<ethash::search_result> &sols, std::vector<uint32_t> &targets);
+    int dag_epoch() const override { return m_dag[m_activeDag].epoch; }
+    // Set the abort flag of every result buffer. Kernels built with FAST_EXIT
+    // return at once, others finish the batches already queued.
+    void abort() override;
 };
 
-void hex_dump(const char *hdr, uint8_t *data, size_t len);
-
 #endif // _XLETH_H
\ No newline at end of file